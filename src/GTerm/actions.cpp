@@ -28,6 +28,7 @@ char str[100];
 		if (mode_flags & NOEOLWRAP) {
 			cursor_x = width-1;
 		} else {
+			wrapped[linenumbers[cursor_y]] = 1;
 			next_line();
 		}
 	}
@@ -48,19 +49,13 @@ str[n] = 0;
 //printf("Processing %d characters (%d): %s\n", n, str[0], str);
 #endif
 
-	if (mode_flags & INSERT) {
-		changed_line(cursor_y, cursor_x, width-1);
-	} else {
-		changed_line(cursor_y, cursor_x, cursor_x+n-1);
-	}
+	if (mode_flags & INSERT) shift_text(cursor_y, cursor_x, width-1, n);
+	changed_line(cursor_y, cursor_x, cursor_x+n-1);
 
 	y = linenumbers[cursor_y]*MAXWIDTH;
-	if (mode_flags & INSERT) for (i=width-1; i>=cursor_x+n; i--) {
-		text[y+i] = text[y+i-n];
-		color[y+i] = color[y+i-n];
-	}
 
 	c = calc_color(fg_color, bg_color, mode_flags);
+	if (c & BLINK) blinking[linenumbers[cursor_y]] = 1;
 	for (i=0; i<n; i++) {
 		text[y+cursor_x] = input_data[i];
 		color[y+cursor_x] = c;
@@ -81,7 +76,7 @@ void GTerm::lf()
 	if (cursor_y < scroll_bot) {
 		move_cursor(cursor_x, cursor_y+1);
 	} else {
-		scroll_region(scroll_top, scroll_bot, 1);
+		scroll_region(scroll_top, scroll_bot, 1, true);
 	}
 	if (mode_flags & NEWLINECR)
 		move_cursor(0, cursor_y);
@@ -175,7 +170,13 @@ void GTerm::reset()
 {
 	int i;
 
+	switch_screen(0);
+	sync_update = 0;
+	sel.active = 0;
+	view_offset = 0;
+	pending_view_scroll = 0;
 	pending_scroll = 0;
+	num_pending_shifts = 0;
 	bg_color = 0;
 	fg_color = 7;
 	scroll_top = 0;
@@ -296,6 +297,20 @@ void GTerm::set_mode()  // h
 			clear_mode_flag(CURSORINVISIBLE);
 			move_cursor(cursor_x, cursor_y);
 			break;
+		case 1047:	// alternate screen
+		case 2047:
+			switch_screen(1);
+			break;
+		case 2049:	// save cursor, then alternate screen cleared
+			save_cursor();
+			switch_screen(1);
+			clear_area(0, 0, width-1, height-1);
+			break;
+		case 3026:	// synchronized update: hold drawing until reset
+			sync_update = 1;
+			sync_deadline = std::chrono::steady_clock::now() +
+				std::chrono::milliseconds(SYNCUPDATETIMEOUT);
+			break;
 	}
 }
 
@@ -314,6 +329,16 @@ void GTerm::clear_mode()  // l
 			set_mode_flag(CURSORINVISIBLE);	break;
 			move_cursor(cursor_x, cursor_y);
 			break;
+		case 1047:	switch_screen(0);	break;
+		case 2047:	// alternate screen is cleared on the way out
+			if (alt_screen) clear_area(0, 0, width-1, height-1);
+			switch_screen(0);
+			break;
+		case 2049:
+			switch_screen(0);
+			restore_cursor();
+			break;
+		case 3026:	sync_update = 0;	break;
 	}
 }
 
@@ -331,9 +356,12 @@ void GTerm::set_margins()
 	t = param[0];
 	if (t<1) t = 1;
 	b = param[1];
-	if (b<1) b = height;
+	if (b<1 || b>height) b = height;
 
-	if (pending_scroll) update_changes();
+	if (pending_scroll) {
+		update_changes();
+		expose_pending_scroll();
+	}
 
 	scroll_top = t-1;
 	scroll_bot = b-1;
@@ -20,6 +20,40 @@ using namespace std;
 void GTerm::ProcessInput(int len, const char *data)
 {
     // printf("ProcessInput called...\n");
+    parse_input(len, data);
+
+    //if (!(mode_flags & DEFERUPDATE) || (pending_scroll > scroll_bot - scroll_top))
+    //    update_changes();
+}
+
+// Parses the front of data, stopping once max_bytes have been taken or
+// max_usecs microseconds have passed (0 means no limit), and returns how
+// much was consumed.  Parser state carries over, so the remainder may be
+// passed in later even if it starts in the middle of an escape sequence.
+int GTerm::ProcessInputSlice(int len, const char *data, int max_bytes, int max_usecs)
+{
+    chrono::steady_clock::time_point deadline;
+    int done, n;
+
+    if (max_bytes <= 0 || max_bytes > len)
+        max_bytes = len;
+    if (max_usecs > 0)
+        deadline = chrono::steady_clock::now() + chrono::microseconds(max_usecs);
+
+    done = 0;
+    while (done < max_bytes)
+    {
+        n = min(max_bytes - done, SLICECHECKBYTES);
+        parse_input(n, data + done);
+        done += n;
+        if (max_usecs > 0 && chrono::steady_clock::now() >= deadline)
+            break;
+    }
+    return done;
+}
+
+void GTerm::parse_input(int len, const char *data)
+{
     int i;
     StateOption *last_state;
 
@@ -41,9 +75,24 @@ void GTerm::ProcessInput(int len, const char *data)
         input_data++;
         data_len--;
     }
+}
 
-    //if (!(mode_flags & DEFERUPDATE) || (pending_scroll > scroll_bot - scroll_top))
-    //    update_changes();
+// Drops an escape sequence that was cut off part way, as when the input
+// after it is thrown away, so the parser reads the next input as text again
+void GTerm::CancelSequence()
+{
+#ifdef GTERM_PC
+    if (mode_flags & PC)
+    {
+        current_state = pc_cmd_state;
+        return;
+    }
+#endif
+    if (current_state == vt52_esc_state || current_state == vt52_cursory_state ||
+        current_state == vt52_cursorx_state)
+        current_state = vt52_normal_state;
+    else if (current_state != vt52_normal_state)
+        current_state = normal_state;
 }
 
 void GTerm::Reset() { reset(); }
@@ -56,16 +105,46 @@ void GTerm::ExposeArea(int x, int y, int w, int h)
 {
     int i;
     for (i = 0; i < h; i++)
-        changed_line(i + y, x, x + w - 1);
+    {
+        // whatever is shown there can't be trusted
+        shadow_forget(i + y, x, x + w - 1);
+        dirty_row(i + y, x, x + w - 1);
+    }
     //if (!(mode_flags & DEFERUPDATE))
     //    update_changes();
 }
 
 void GTerm::ResizeTerminal(int w, int h)
 {
-    int cx, cy;
-    clear_area(min(width, w), 0, MAXWIDTH - 1, MAXHEIGHT - 1);
-    clear_area(0, min(height, h), min(width, w) - 1, MAXHEIGHT - 1);
+    int cx, cy, expose;
+    flush_pending_shifts();
+    // a scroll not yet copied was recorded against the old size
+    expose_pending_scroll();
+    // back to following output
+    expose = view_offset;
+    view_offset = 0;
+    pending_view_scroll = 0;
+    // the front end may keep or lose any of its pixels
+    shadow_forget_all();
+    if (w != width && !alt_screen && !(mode_flags & PC))
+    {
+        // wrapped lines are joined up again; history waits until it is seen
+        reflow_screen(w, h);
+        expose = 1;
+    }
+    else
+    {
+        clear_area(min(width, w), 0, MAXWIDTH - 1, MAXHEIGHT - 1);
+        clear_area(0, min(height, h), min(width, w) - 1, MAXHEIGHT - 1);
+    }
+    if (alt_text)
+    {
+        // the screen not being shown gets the same treatment
+        swap_screens();
+        clear_area(min(width, w), 0, MAXWIDTH - 1, MAXHEIGHT - 1);
+        clear_area(0, min(height, h), min(width, w) - 1, MAXHEIGHT - 1);
+        swap_screens();
+    }
     width = w;
     height = h;
     scroll_bot = height - 1;
@@ -74,6 +153,8 @@ void GTerm::ResizeTerminal(int w, int h)
     cx = min(width - 1, cursor_x);
     cy = min(height - 1, cursor_y);
     move_cursor(cx, cy);
+    if (expose)
+        ExposeAll();
 }
 
 GTerm::GTerm(int w, int h) : width(w), height(h)
@@ -81,10 +162,45 @@ GTerm::GTerm(int w, int h) : width(w), height(h)
     int i;
 
     doing_update = 0;
+    num_pending_shifts = 0;
+    drawn_cursor_x = 0;
+    drawn_cursor_y = -1;
+    cursor_overlay = 0;
+    cursor_shown = 0;
 
     // could make this dynamic
     text = new unsigned char[MAXWIDTH * MAXHEIGHT];
     color = new unsigned short[MAXWIDTH * MAXHEIGHT];
+    linenumbers = new short[MAXHEIGHT];
+    wrapped = new unsigned char[MAXHEIGHT];
+    memset(wrapped, 0, MAXHEIGHT);
+    blinking = new unsigned char[MAXHEIGHT];
+    memset(blinking, 0, MAXHEIGHT);
+    blink_hidden = 0;
+    memset(line_version, 0, sizeof(line_version));
+    version_clock = 0;
+    alt_text = nullptr;
+    alt_color = nullptr;
+    alt_linenumbers = nullptr;
+    alt_wrapped = nullptr;
+    alt_blinking = nullptr;
+    alt_screen = 0;
+    sync_update = 0;
+    parse_only = 0;
+    two_pass_draw = 0;
+    shadow_text = new unsigned char[MAXWIDTH * MAXHEIGHT];
+    shadow_color = new uint32_t[MAXWIDTH * MAXHEIGHT];
+    shadow_forget_all();
+    shadow_diff = 1;
+    memset(&draw_stats, 0, sizeof(draw_stats));
+    shadow_tile_rows.resize(MAXHEIGHT * TILECOLUMNS);
+    new_tile_rows.resize(MAXHEIGHT * TILECOLUMNS);
+    sel.active = 0;
+    scrolled_lines = 0;
+    alt_scrolled_lines = 0;
+    history_size = DEFAULTHISTORY;
+    view_offset = 0;
+    pending_view_scroll = 0;
 
     for (i = 0; i < MAXHEIGHT; i++)
     {
@@ -109,6 +225,16 @@ GTerm::~GTerm()
 {
     delete[] text;
     delete[] color;
+    delete[] linenumbers;
+    delete[] wrapped;
+    delete[] blinking;
+    delete[] alt_text;
+    delete[] alt_color;
+    delete[] alt_linenumbers;
+    delete[] alt_wrapped;
+    delete[] alt_blinking;
+    delete[] shadow_text;
+    delete[] shadow_color;
 #ifdef GTERM_PC
     if (pc_machinename)
         delete[] pc_machinename;
@@ -128,45 +254,391 @@ void GTerm::SetMachineName(char *machinename)
 
 int GTerm::IsSelected(int x, int y)
 {
-    if (color && x >= 0 && x < Width() && y >= 0 && y < Height())
-        return color[(linenumbers[y] * MAXWIDTH) + x] & SELECTED;
+    int sx, ex;
+
+    if (x >= 0 && x < Width() && y >= 0 && y < Height() &&
+        selection_span(sel, view_top(), y, sx, ex))
+        return x >= sx && x <= ex;
     return 0;
 }
 
+// Cells are read from the view, as they are drawn.
 int GTerm::IsUnderlined(int x, int y)
 {
+    unsigned char *t;
+    unsigned short *c;
+
     if (color && x >= 0 && x < Width() && y >= 0 && y < Height())
-        return color[(linenumbers[y] * MAXWIDTH) + x] & UNDERLINE;
+    {
+        row_source(y, t, c);
+        return c[x] & UNDERLINE;
+    }
     return 0;
 }
 
-void GTerm::Select(int x, int y, int select)
+// Keeps a cell the selection is given on the view, where callers such as a
+// mouse dragged outside the window may put it beyond the edges.
+void GTerm::clamp_cell(int &x, int &y)
 {
-    if (color && x >= 0 && x < Width() && y >= 0 && y < Height())
+    x = max(0, min(x, width - 1));
+    y = max(0, min(y, height - 1));
+}
+
+// Selection is made with coordinates on the view, but follows the text as
+// it scrolls.  The anchor is where the mouse went down, the extent where it is
+// now; both cells are included.
+void GTerm::SelectStart(int x, int y)
+{
+    Selection s;
+
+    clamp_cell(x, y);
+    s.active = 1;
+    s.anchor_x = s.extent_x = x;
+    s.anchor_line = s.extent_line = view_top() + y;
+    set_selection(s);
+}
+
+void GTerm::SelectExtend(int x, int y)
+{
+    Selection s = sel;
+
+    if (!s.active)
+    {
+        SelectStart(x, y);
+        return;
+    }
+    clamp_cell(x, y);
+    s.extent_x = x;
+    s.extent_line = view_top() + y;
+    set_selection(s);
+}
+
+void GTerm::SelectRange(int x1, int y1, int x2, int y2)
+{
+    Selection s;
+
+    clamp_cell(x1, y1);
+    clamp_cell(x2, y2);
+    s.active = 1;
+    s.anchor_x = x1;
+    s.anchor_line = view_top() + y1;
+    s.extent_x = x2;
+    s.extent_line = view_top() + y2;
+    set_selection(s);
+}
+
+void GTerm::SelectNone()
+{
+    Selection s;
+
+    s.active = 0;
+    set_selection(s);
+}
+
+bool GTerm::HasSelection()
+{
+    return sel.active && (sel.anchor_x != sel.extent_x || sel.anchor_line != sel.extent_line);
+}
+
+// Returns the selection in absolute lines, first cell first.  The lines
+// may have scrolled out of view, or out of history altogether.
+bool GTerm::GetSelectionBounds(int64_t &line1, int &x1, int64_t &line2, int &x2)
+{
+    if (!HasSelection())
+        return false;
+    if (sel.anchor_line < sel.extent_line ||
+        (sel.anchor_line == sel.extent_line && sel.anchor_x <= sel.extent_x))
+    {
+        line1 = sel.anchor_line;
+        x1 = sel.anchor_x;
+        line2 = sel.extent_line;
+        x2 = sel.extent_x;
+    }
+    else
+    {
+        line1 = sel.extent_line;
+        x1 = sel.extent_x;
+        line2 = sel.anchor_line;
+        x2 = sel.anchor_x;
+    }
+    return true;
+}
+
+// Moves the view lines back into history (negative toward the live
+// screen).  The rows still in view are copied rather than redrawn.
+void GTerm::ScrollView(int lines)
+{
+    int offset, num, y, takey;
+    uint16_t temp_sx[MAXHEIGHT], temp_ex[MAXHEIGHT];
+
+    offset = view_offset + lines;
+    while (offset > (int)history.size() && !alt_screen && reflow_history())
+        ;
+    if (offset > (int)history.size())
+        offset = history.size();
+    if (offset < 0 || alt_screen)
+        offset = 0;
+    num = view_offset - offset;
+    if (!num)
+        return;
+
+    // copies still pending were recorded against the old view
+    flush_pending_shifts();
+    expose_pending_scroll();
+
+    memcpy(temp_sx, dirty_startx, sizeof(dirty_startx));
+    memcpy(temp_ex, dirty_endx, sizeof(dirty_endx));
+    for (y = 0; y < height; y++)
     {
-        if (select)
+        takey = y + num;
+        if (takey < 0 || takey >= height)
         {
-            //if (0 == (color[(linenumbers[y] * MAXWIDTH) + x] & SELECTED))
-            {
-                color[(linenumbers[y] * MAXWIDTH) + x] |= SELECTED;
-                changed_line(y, x, x);
-            }
+            dirty_startx[y] = 0;
+            dirty_endx[y] = width - 1;
         }
         else
         {
-            //if (0 != (color[(linenumbers[y] * MAXWIDTH) + x] & SELECTED))
-            {
-                color[(linenumbers[y] * MAXWIDTH) + x] &= ~SELECTED;
-                changed_line(y, x, x);
-            }
+            dirty_startx[y] = temp_sx[takey];
+            dirty_endx[y] = temp_ex[takey];
         }
     }
+    if (drawn_cursor_y >= 0)
+    {
+        drawn_cursor_y -= num;
+        if (drawn_cursor_y < 0 || drawn_cursor_y >= height)
+            drawn_cursor_y = -1;
+    }
+
+    view_offset = offset;
+    pending_view_scroll += num;
+}
+
+void GTerm::SetHistorySize(int lines)
+{
+    if (lines < 0)
+        lines = 0;
+    history_size = lines;
+    while (!history_old.empty() && (int)(history.size() + history_old.size()) > history_size)
+        history_old.pop_front();
+    while ((int)history.size() > history_size)
+        history.pop_front();
+    if (view_offset > (int)history.size())
+    {
+        view_offset = history.size();
+        ExposeAll();
+    }
+}
+
+size_t GTerm::GetMemoryUse()
+{
+    size_t cells = (size_t)MAXWIDTH * MAXHEIGHT, bytes;
+
+    // text and colour, and the row tables
+    bytes = cells * (1 + sizeof(unsigned short)) + MAXHEIGHT * (sizeof(short) + 2);
+    if (alt_text)
+        bytes *= 2;
+    bytes += cells * (1 + sizeof(uint32_t));
+    for (const HistoryLine &line : history)
+        bytes += sizeof(line) + line.text.capacity() + line.color.capacity() * sizeof(unsigned short);
+    for (const HistoryLine &line : history_old)
+        bytes += sizeof(line) + line.text.capacity() + line.color.capacity() * sizeof(unsigned short);
+    return bytes;
+}
+
+// Returns line (numbered as in GetSelectionBounds) and its length, or
+// NULL if it is no longer kept.
+const unsigned char *GTerm::GetLine(int64_t line, int *len)
+{
+    int64_t first;
+    int r;
+
+    first = scrolled_lines;
+    if (!alt_screen)
+        first -= history.size();
+    if (line < first)
+        return nullptr;
+    if (line < scrolled_lines)
+    {
+        HistoryLine &h = history[line - first];
+        *len = h.text.size();
+        return h.text.data();
+    }
+    r = line - scrolled_lines;
+    if (r >= height)
+        return nullptr;
+    *len = width;
+    return text + linenumbers[r] * MAXWIDTH;
+}
+
+// GetLineSlice of a line of len characters at t.
+static int slice_line(const unsigned char *t, int len, bool wrapped, int start_x, int end_x,
+                      const unsigned char **text)
+{
+    // columns may come from anywhere, so keep them within the line
+    if (start_x < 0)
+        start_x = 0;
+    if (start_x >= len)
+        return 0;
+    if (end_x >= len)
+        end_x = len - 1;
+    if (end_x < start_x)
+        return 0;
+    // blanks where a line wrapped were written by the application
+    if (!wrapped)
+        while (end_x >= start_x && (t[end_x] == ' ' || !t[end_x]))
+            end_x--;
+    *text = t + start_x;
+    return end_x >= start_x ? end_x - start_x + 1 : 0;
+}
+
+// Adds a row of ExtractText at n, and the newline after it unless it
+// wrapped, returning the length so far.
+static size_t append_row(char *buf, size_t size, size_t n, const unsigned char *t, int len, bool newline)
+{
+    char *p, *end;
+
+    if (len > 0 && n + len <= size)
+    {
+        memcpy(buf + n, t, len);
+        // never-written cells hold 0
+        end = buf + n + len;
+        for (p = (char *)memchr(buf + n, 0, len); p; p = (char *)memchr(p, 0, end - p))
+            *p++ = ' ';
+    }
+    if (len > 0)
+        n += len;
+    if (newline)
+    {
+        if (n < size)
+            buf[n] = '\n';
+        n++;
+    }
+    return n;
+}
+
+// Finds columns start_x to end_x of line, leaving off trailing blanks.
+// Returns the length, or -1 if the line is no longer kept.
+int GTerm::GetLineSlice(int64_t line, int start_x, int end_x, const unsigned char **text)
+{
+    const unsigned char *t;
+    int len;
+
+    t = GetLine(line, &len);
+    if (!t)
+        return -1;
+    return slice_line(t, len, IsLineWrapped(line), start_x, end_x, text);
+}
+
+// Copies the text from line1 column x1 through line2 column x2 into buf,
+// a row at a time, with a newline between rows unless the row wrapped.
+// Like snprintf it writes at most size bytes and returns the length the
+// whole text needs.
+size_t GTerm::ExtractText(int64_t line1, int x1, int64_t line2, int x2, char *buf, size_t size)
+{
+    const unsigned char *t;
+    int64_t line;
+    size_t n;
+    int len;
+
+    n = 0;
+    for (line = line1; line <= line2; line++)
+    {
+        len = GetLineSlice(line, line == line1 ? x1 : 0, line == line2 ? x2 : MAXWIDTH - 1, &t);
+        n = append_row(buf, size, n, t, len, line != line2 && !IsLineWrapped(line));
+    }
+    return n;
+}
+
+// Copies lines line1 to line2 into snap for ExtractText, whole, as
+// trimming them is left to it.  Lines no longer kept come out empty.
+void GTerm::SnapshotText(int64_t line1, int x1, int64_t line2, int x2, TextSnapshot &snap)
+{
+    const unsigned char *t;
+    int64_t line;
+    int len;
+
+    snap.text.clear();
+    snap.ends.clear();
+    snap.wrapped.clear();
+    snap.x1 = x1;
+    snap.x2 = x2;
+    for (line = line1; line <= line2; line++)
+    {
+        t = GetLine(line, &len);
+        if (t)
+            snap.text.insert(snap.text.end(), t, t + len);
+        snap.ends.push_back(snap.text.size());
+        snap.wrapped.push_back(t && IsLineWrapped(line));
+    }
+}
+
+// ExtractText of the lines in a snapshot, which touches nothing else so
+// may be called on any thread.
+size_t GTerm::ExtractText(const TextSnapshot &snap, char *buf, size_t size)
+{
+    const unsigned char *t;
+    size_t i, n, start, last;
+    int len;
+
+    n = 0;
+    last = snap.ends.size() - 1;
+    for (i = 0; i < snap.ends.size(); i++)
+    {
+        start = i ? snap.ends[i - 1] : 0;
+        len = slice_line(snap.text.data() + start, snap.ends[i] - start,
+                         snap.wrapped[i], i == 0 ? snap.x1 : 0, i == last ? snap.x2 : MAXWIDTH - 1, &t);
+        n = append_row(buf, size, n, t, len, i != last && !snap.wrapped[i]);
+    }
+    return n;
+}
+
+// Whether screen row y wrapped onto the row below it.
+bool GTerm::IsWrapped(int y)
+{
+    if (y >= 0 && y < height)
+        return wrapped[linenumbers[y]] != 0;
+    return false;
+}
+
+// Whether line, numbered as in GetSelectionBounds, wrapped onto the next.
+bool GTerm::IsLineWrapped(int64_t line)
+{
+    int64_t first;
+
+    if (line >= scrolled_lines)
+        return IsWrapped(line - scrolled_lines);
+    first = scrolled_lines;
+    if (!alt_screen)
+        first -= history.size();
+    if (line < first)
+        return false;
+    return history[line - first].wrapped != 0;
+}
+
+// Finds the lines that the logical line containing line was wrapped
+// onto, as far as they are still kept.
+void GTerm::GetLogicalLine(int64_t line, int64_t *first, int64_t *last)
+{
+    int len;
+
+    *first = line;
+    while (IsLineWrapped(*first - 1) && GetLine(*first - 1, &len))
+        (*first)--;
+    *last = line;
+    while (IsLineWrapped(*last) && GetLine(*last + 1, &len))
+        (*last)++;
 }
 
 unsigned char GTerm::GetChar(int x, int y)
 {
+    unsigned char *t;
+    unsigned short *c;
+
     if (text && x >= 0 && x < Width() && y >= 0 && y < Height())
-        return text[(linenumbers[y] * MAXWIDTH) + x];
+    {
+        row_source(y, t, c);
+        return t[x];
+    }
 
     return 0;
 }
@@ -19,9 +19,22 @@ License: wxWindows License Version 3.1 (See the file license3.txt)
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <chrono>
+#include <deque>
+#include <unordered_map>
+#include <vector>
 
 #define MAXWIDTH 400
 #define MAXHEIGHT 600
+#define MAXPENDINGSHIFTS 32
+#define SYNCUPDATETIMEOUT 150 // ms a synchronized update may hold back drawing
+#define SLICECHECKBYTES 4096  // bytes parsed between clock checks in ProcessInputSlice
+#define DEFAULTHISTORY 1000   // lines kept after they scroll off the top
+#define SHADOWUNKNOWN 0xffffffff // shadow_color of a cell whose pixels may not match its text
+#define SHADOWGAP 4           // unchanged cells drawn anyway to join two changed ones
+#define TILEWIDTH 32          // columns in a tile the screen is split into for reuse
+#define TILEHEIGHT 16         // and rows
+#define TILECOLUMNS ((MAXWIDTH + TILEWIDTH - 1) / TILEWIDTH)
 
 class GTerm;
 typedef void (GTerm:: *StateFunc)();
@@ -56,19 +69,117 @@ public:
         LOCALECHO = 0x4000,
         CURSORINVISIBLE = 0x8000,
         PC = 0x10000,
-        SELECTED = 0x20000 // flag to indicate a char is selected
+        SELECTED = 0x20000, // flag to indicate a char is selected
+        BACKGROUNDDRAWN = 0x40000 // passed to DrawText when ClearChars has filled behind the text
     } MODES;
 
+    // counts kept by update_changes
+    struct DrawStats
+    {
+        uint64_t cells_dirty;   // cells marked as changed
+        uint64_t cells_skipped; // of those, cells already showing what they hold
+        uint64_t rows_skipped;  // dirty rows rejected by their hash alone
+        uint64_t tiles_dirty;   // tiles with dirty cells
+        uint64_t tiles_unchanged; // of those, tiles hashing the same as what is shown
+        uint64_t tiles_moved;   // and tiles copied from where their contents are shown
+    };
+
 private:
     // terminal info
     int width, height, scroll_top, scroll_bot;
     unsigned char *text;
     unsigned short *color;
-    short linenumbers[MAXHEIGHT]; // text at text[linenumbers[y]*MAXWIDTH]
+    short *linenumbers; // text at text[linenumbers[y]*MAXWIDTH]
+    unsigned char *wrapped; // wrapped[linenumbers[y]]: row y continues on row y+1
+    unsigned char *blinking; // blinking[linenumbers[y]]: row y may have BLINK text; cleared
+                             // when a blink finds none there
+    uint32_t line_version[MAXHEIGHT]; // line_version[linenumbers[y]]: stamped from
+                                      // version_clock whenever row y changes
+    uint32_t version_clock;
+
+    // the screen not being shown, allocated the first time it is needed
+    unsigned char *alt_text;
+    unsigned short *alt_color;
+    short *alt_linenumbers;
+    unsigned char *alt_wrapped;
+    unsigned char *alt_blinking;
+    int alt_screen; // non-zero while the alternate screen is shown
     uint16_t dirty_startx[MAXHEIGHT], dirty_endx[MAXHEIGHT];
     int pending_scroll; // >0 means scroll up
     int doing_update;
 
+    // horizontal shifts done by shift_text, blitted by update_changes
+    struct PendingShift
+    {
+        short y, start_x, end_x, num; // num >0 means shift right
+    };
+    PendingShift pending_shifts[MAXPENDINGSHIFTS];
+    int num_pending_shifts;
+    int drawn_cursor_x, drawn_cursor_y; // where update_changes last drew it, -1 if nowhere
+    int cursor_overlay; // the front end draws the cursor over the text rather than into it
+    int cursor_shown;   // an overlay cursor was last given to DrawCursor, not HideCursor
+    int sync_update; // non-zero between DECSET 2026 and DECRST 2026
+    int parse_only;  // nothing is drawn or marked dirty until it is turned off
+
+    // selection, kept in absolute lines: screen row y is line scrolled_lines + y
+    struct Selection
+    {
+        int active;
+        int anchor_x, extent_x;
+        int64_t anchor_line, extent_line;
+    };
+    Selection sel;
+    int64_t scrolled_lines; // lines scrolled off the top of the screen
+    int64_t alt_scrolled_lines;
+
+    // lines scrolled off the top of the main screen, oldest first; the last
+    // one is line scrolled_lines - 1
+    struct HistoryLine
+    {
+        std::vector<unsigned char> text;
+        std::vector<unsigned short> color;
+        int wrapped; // continues on the next line
+    };
+    std::deque<HistoryLine> history;
+    // lines from before the last width change, older than any in history and
+    // rewrapped onto the front of it as the view is scrolled back to them
+    std::deque<HistoryLine> history_old;
+    int history_size;        // most lines kept
+    int view_offset;         // lines scrolled back into history, 0 when following output
+    int pending_view_scroll; // >0 means the view moved toward newer lines
+    unsigned char view_text[MAXWIDTH]; // a history line padded to the width
+    unsigned short view_color[MAXWIDTH];
+    std::chrono::steady_clock::time_point sync_deadline;
+
+    // text held back by a two-pass update_changes until every background
+    // has been cleared
+    struct TextRun
+    {
+        int c, x, y, len;
+        size_t offset; // into run_text, where the run is followed by a 0
+    };
+    std::vector<TextRun> text_runs;
+    std::vector<unsigned char> run_text;
+    int two_pass_draw;
+
+    // what update_changes last drew on each screen row, MAXWIDTH cells to a
+    // row, so cells written again with what they already show are skipped
+    unsigned char *shadow_text;
+    uint32_t *shadow_color; // run colour with SELECTED, or SHADOWUNKNOWN
+    uint64_t shadow_hash[MAXHEIGHT];
+    unsigned char shadow_hashed[MAXHEIGHT]; // shadow_hash is that of the whole row
+    uint32_t row_color[MAXWIDTH];           // the row being updated, as it is to be drawn
+    int shadow_diff;
+    DrawStats draw_stats;
+    int blink_hidden; // BLINK text is in its off phase, and drawn blank
+    unsigned char blink_text[MAXWIDTH]; // a row with its blinking text blanked
+
+    // hashes of TILEWIDTH cells of each row, for the shadow and for what is
+    // to be drawn, TILECOLUMNS to a row
+    std::vector<uint64_t> shadow_tile_rows, new_tile_rows;
+    // where each tile-sized area of the shadow is, by its hash and column
+    std::unordered_map<uint64_t, int> tile_sources;
+
     // terminal state
     int cursor_x, cursor_y;
     int save_x, save_y, save_attrib;
@@ -232,12 +343,44 @@ private:
 public:
     // utility functions
     void update_changes();
+    void reuse_tiles();
+    uint64_t tile_hash(const std::vector<uint64_t> &rows, int y, int tx);
+    void shown_row(int y, unsigned char *&t);
+    void draw_span(int y, int start_x, int end_x, unsigned char *t);
+    void draw_run(int c, int blank, int x, int y, int len, unsigned char *t);
+    void draw_text_runs();
+    void run_colors(int c, int &fg, int &bg);
     bool changes_pending();
-    void scroll_region(int start_y, int end_y, int num); // does clear
+    // does clear; only a line feed scrolling the whole screen keeps the lines it takes off
+    void scroll_region(int start_y, int end_y, int num, bool line_feed = false);
     void shift_text(int y, int start_x, int end_x, int num); // ditto
+    void flush_pending_shifts();
+    void swap_screens();
+    void switch_screen(int alt);
+    bool sync_held();
+    void parse_input(int len, const char *data);
+    bool selection_span(const Selection &s, int64_t scrolled, int y, int &sx, int &ex);
+    void set_selection(const Selection &s);
+    void selection_scrolled(int start_y, int end_y, int num, int64_t old_scrolled);
+    int64_t view_top() { return scrolled_lines - view_offset; }
+    void dirty_row(int y, int start_x, int end_x);
+    void push_history(int y);
+    HistoryLine &new_history_line();
+    void rewrap(std::deque<HistoryLine> &lines, int first, int last, int w, std::deque<HistoryLine> &out,
+                int cur_line, int cur_x, int *row, int *x);
+    void reflow_screen(int w, int h);
+    bool reflow_history();
+    void row_source(int y, unsigned char *&t, unsigned short *&c);
+    void clamp_cell(int &x, int &y);
+    void move_chars(int sx, int sy, int dx, int dy, int w, int h);
+    void shadow_forget(int y, int start_x, int end_x);
+    void shadow_forget_all();
+    uint64_t cells_hash(const unsigned char *t, const uint32_t *c, int n);
+    void expose_pending_scroll();
     void clear_area(int start_x, int start_y, int end_x, int end_y);
     void changed_line(int y, int start_x, int end_x);
     void move_cursor(int x, int y);
+    void note_blinking(int y, int w);
     int calc_color(int fg, int bg, int flags);
 
 private:
@@ -301,6 +444,8 @@ public:
 
     // function to control terminal
     virtual void ProcessInput(int len, const char *data);
+    int ProcessInputSlice(int len, const char *data, int max_bytes, int max_usecs);
+    void CancelSequence();
     virtual void ProcessOutput(int len, const char *data) { SendBack(len, data); }
     virtual void ResizeTerminal(int width, int height);
     int Width() { return width; }
@@ -320,10 +465,17 @@ public:
                           unsigned char *string) = 0;
     virtual void DrawCursor(int fg_color, int bg_color, int flags, int x, int y,
                             unsigned char c) = 0;
+    // with SetCursorOverlay, called instead of DrawCursor when there is no cursor to show
+    virtual void HideCursor() {}
 
     // optional child-supplied functions
     virtual void MoveChars(int sx, int sy, int dx, int dy, int w, int h) {}
     virtual void ClearChars(int clear_bg_color, int x, int y, int w, int h) {}
+    // the colour DrawText would fill behind text drawn with these arguments
+    virtual int TextBackground(int fg_color, int bg_color, int flags)
+    {
+        return flags & INVERSE ? fg_color : bg_color;
+    }
     virtual void SendBack(int len, const char *data) {}
     virtual void SendBack(const char *data) { SendBack(strlen(data), data); }
     virtual void ModeChange(int state) {}
@@ -343,11 +495,73 @@ public:
 #endif // GTERM_PC
 
     virtual int IsSelected(int x, int y);
-    virtual void Select(int x, int y, int select);
+    void SelectStart(int x, int y);
+    void SelectExtend(int x, int y);
+    void SelectRange(int x1, int y1, int x2, int y2);
+    void SelectNone();
+    bool HasSelection();
+    bool GetSelectionBounds(int64_t &line1, int &x1, int64_t &line2, int &x2);
+
+    // scrollback
+    void ScrollView(int lines);
+    int GetViewOffset() { return view_offset; }
+    void SetHistorySize(int lines);
+    int GetHistorySize() { return history_size; }
+    // lines from before a width change count as they were before it
+    int HistoryLines() { return (int)(history.size() + history_old.size()); }
+    size_t GetMemoryUse(); // bytes held by the screens, shadow and history
+    const unsigned char *GetLine(int64_t line, int *len);
+    int GetLineSlice(int64_t line, int start_x, int end_x, const unsigned char **text);
+    bool IsWrapped(int y);
+    bool IsLineWrapped(int64_t line);
+    void GetLogicalLine(int64_t line, int64_t *first, int64_t *last);
+    size_t ExtractText(int64_t line1, int x1, int64_t line2, int x2, char *buf, size_t size);
+    // lines copied out as they are kept, so their text can be extracted on
+    // another thread while this one goes on changing them
+    struct TextSnapshot
+    {
+        std::vector<unsigned char> text;    // the lines, one after another
+        std::vector<size_t> ends;           // where each ends in text
+        std::vector<unsigned char> wrapped; // whether each continues on the next
+        int x1, x2;
+    };
+    void SnapshotText(int64_t line1, int x1, int64_t line2, int x2, TextSnapshot &snap);
+    static size_t ExtractText(const TextSnapshot &snap, char *buf, size_t size);
+    int64_t ViewTopLine() { return view_top(); }
     virtual unsigned char GetChar(int x, int y);
     virtual int IsUnderlined(int x, int y);
     int GetCursorX();
     int GetCursorY();
+    bool IsAlternateScreen() { return alt_screen != 0; }
+    bool IsSyncUpdate() { return sync_held(); }
+    // changes whenever the text or colours of screen row y may have, even
+    // while nothing is drawn; a row scrolled to another place keeps its own
+    uint32_t RowVersion(int y) { return line_version[linenumbers[y]]; }
+    // the text and colours of screen row y, whatever is in view
+    void GetScreenRow(int y, const unsigned char **t, const unsigned short **c)
+    {
+        *t = text + linenumbers[y] * MAXWIDTH;
+        *c = color + linenumbers[y] * MAXWIDTH;
+    }
+    // keep the text current without tracking what to draw, while not shown;
+    // turning it off has every row drawn again
+    void SetParseOnly(bool on);
+    bool IsParseOnly() { return parse_only != 0; }
+    // clear all the backgrounds first, then draw the text over them
+    void SetTwoPassDraw(bool on) { two_pass_draw = on; }
+    // blinking text: whether there may be any on screen, and hiding or showing
+    // it, which dirties only its cells; true if there was some to change
+    bool HasBlinkText();
+    bool BlinkText(bool hidden);
+    // DrawCursor only says where the cursor is, and the cells under it are
+    // never drawn again on its account
+    void SetCursorOverlay(bool on);
+    bool GetCursorOverlay() { return cursor_overlay != 0; }
+    bool GetTwoPassDraw() { return two_pass_draw != 0; }
+    // only redraw dirty cells whose text or attributes differ from what was drawn
+    void SetShadowDiff(bool on);
+    bool GetShadowDiff() { return shadow_diff != 0; }
+    const DrawStats &GetDrawStats() { return draw_stats; }
 };
 
 #endif
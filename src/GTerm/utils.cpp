@@ -10,107 +10,160 @@ License: wxWindows License Version 3.1 (See the file license3.txt)
 
 
 #include "gterm.hpp"
+#include <algorithm>
 // #include <stdlib.h>
 
+using namespace std;
+
 int GTerm::calc_color(int fg, int bg, int flags) { return (flags & 15) | (fg << 4) | (bg << 8); }
 
 bool GTerm::changes_pending()
 {
     int y;
+    if (sync_held() || parse_only)
+        return false;
     for (y = 0; y < height; y++)
     {
         if (dirty_startx[y] >= MAXWIDTH)
             continue;
         return true;
     }
+    // an overlay cursor that moved leaves nothing dirty behind it
+    if (cursor_overlay)
+    {
+        y = cursor_y + view_offset;
+        if (mode_flags & CURSORINVISIBLE || y >= height)
+            return cursor_shown != 0;
+        return !cursor_shown || drawn_cursor_y != y || drawn_cursor_x != min(cursor_x, width - 1);
+    }
     return false;
 }
 void GTerm::update_changes()
 {
-    int yp, start_x, mx;
-    int blank, c, x, y;
+    int yp, start_x, end_x, mx, run_x, last_x, drawn;
+    int c, x, y, i;
+    unsigned char *rtext;
+    uint64_t hash;
 
     // prevent recursion for scrolls which cause exposures
     if (doing_update)
         return;
+    // the application is in the middle of a frame; draw it once it is done
+    if (sync_held() || parse_only)
+        return;
     doing_update = 1;
 
-    // first perform scroll-copy
+    // first follow the view through history
+    if (!(mode_flags & TEXTONLY) && pending_view_scroll && pending_view_scroll < height &&
+        -pending_view_scroll < height)
+    {
+        if (pending_view_scroll < 0)
+            move_chars(0, 0, 0, -pending_view_scroll, width, height + pending_view_scroll);
+        else
+            move_chars(0, pending_view_scroll, 0, 0, width, height - pending_view_scroll);
+    }
+    pending_view_scroll = 0;
+
+    // then perform scroll-copy
     mx = scroll_bot - scroll_top + 1;
     if (!(mode_flags & TEXTONLY) && pending_scroll && pending_scroll < mx && -pending_scroll < mx)
     {
         if (pending_scroll < 0)
         {
-            MoveChars(0, scroll_top, 0, scroll_top - pending_scroll, width,
-                      scroll_bot - scroll_top + pending_scroll + 1);
+            move_chars(0, scroll_top, 0, scroll_top - pending_scroll, width,
+                       scroll_bot - scroll_top + pending_scroll + 1);
         }
         else
         {
-            MoveChars(0, scroll_top + pending_scroll, 0, scroll_top, width,
-                      scroll_bot - scroll_top - pending_scroll + 1);
+            move_chars(0, scroll_top + pending_scroll, 0, scroll_top, width,
+                       scroll_bot - scroll_top - pending_scroll + 1);
         }
     }
     pending_scroll = 0;
 
+    // then perform the horizontal copies, in the order they were made
+    for (i = 0; i < num_pending_shifts; i++)
+    {
+        PendingShift &s = pending_shifts[i];
+        mx = s.end_x - s.start_x + 1;
+        if (s.num > 0)
+            move_chars(s.start_x, s.y, s.start_x + s.num, s.y, mx - s.num, 1);
+        else
+            move_chars(s.start_x - s.num, s.y, s.start_x, s.y, mx + s.num, 1);
+    }
+    num_pending_shifts = 0;
+
+    // the old cursor image may have been copied along with the text
+    if (!cursor_overlay && drawn_cursor_y >= 0 && drawn_cursor_y < height && drawn_cursor_x < width)
+        dirty_row(drawn_cursor_y, drawn_cursor_x, drawn_cursor_x);
+    drawn_cursor_y = -1;
+
+    // then copy tiles that are already shown elsewhere
+    if (shadow_diff && !(mode_flags & TEXTONLY))
+        reuse_tiles();
+
     // then update characters
     for (y = 0; y < height; y++)
     {
         if (dirty_startx[y] >= MAXWIDTH)
             continue;
-        yp = linenumbers[y] * MAXWIDTH;
-
-        blank = !(mode_flags & TEXTONLY);
         start_x = dirty_startx[y];
-        c = color[yp + start_x];
-        for (x = start_x; x <= dirty_endx[y]; x++)
+        end_x = min((int)dirty_endx[y], width - 1);
+        dirty_endx[y] = 0;
+        dirty_startx[y] = MAXWIDTH;
+        if (start_x > end_x)
+            continue;
+        shown_row(y, rtext);
+        draw_stats.cells_dirty += end_x - start_x + 1;
+        if (!shadow_diff)
         {
-            if (text[yp + x] != 32 && text[yp + x])
-                blank = 0;
-            if (c != color[yp + x])
-            {
-                if (!blank)
-                {
-#ifdef GTERM_PC
-                    if (mode_flags & PC)
-                        DrawText((c >> 4) & 0xf, (c >> 8) & 0xf, c /*&15*/, start_x, y, x - start_x,
-                                 text + yp + start_x);
-                    else
-#endif
-                        DrawText((c >> 4) & 7, (c >> 8) & 7, c /*&15*/, start_x, y, x - start_x,
-                                 text + yp + start_x);
-                }
-                else
-                {
-                    ClearChars((c >> 8) & 7, start_x, y, x - start_x, 1);
-                }
-                start_x = x;
-                c = color[yp + x];
-                blank = !(mode_flags & TEXTONLY);
-                if (text[yp + x] != 32 && text[yp + x])
-                    blank = 0;
-            }
+            draw_span(y, start_x, end_x, rtext);
+            continue;
         }
-        if (!blank)
+
+        // a row written again just as it was is rejected by its hash
+        hash = cells_hash(rtext, row_color, width);
+        if (shadow_hashed[y] && hash == shadow_hash[y])
         {
-#ifdef GTERM_PC
-            if (mode_flags & PC)
-                DrawText((c >> 4) & 0xf, (c >> 8) & 0xf, c /*&15*/, start_x, y, x - start_x,
-                         text + yp + start_x);
-            else
-#endif
-                DrawText((c >> 4) & 7, (c >> 8) & 7, c /*&15*/, start_x, y, x - start_x,
-                         text + yp + start_x);
+            draw_stats.cells_skipped += end_x - start_x + 1;
+            draw_stats.rows_skipped++;
+            continue;
         }
-        else
+
+        // otherwise only the cells that differ from the shadow are drawn,
+        // joined across short gaps so the text isn't cut into tiny runs
+        yp = y * MAXWIDTH;
+        drawn = 0;
+        for (x = start_x; x <= end_x;)
         {
-            ClearChars((c >> 8) & 7, start_x, y, x - start_x, 1);
+            if (shadow_text[yp + x] == rtext[x] && shadow_color[yp + x] == row_color[x])
+            {
+                x++;
+                continue;
+            }
+            run_x = last_x = x;
+            for (; x <= end_x && x - last_x <= SHADOWGAP; x++)
+                if (shadow_text[yp + x] != rtext[x] || shadow_color[yp + x] != row_color[x])
+                    last_x = x;
+            draw_span(y, run_x, last_x, rtext);
+            memcpy(shadow_text + yp + run_x, rtext + run_x, last_x - run_x + 1);
+            memcpy(shadow_color + yp + run_x, row_color + run_x, (last_x - run_x + 1) * sizeof(uint32_t));
+            drawn += last_x - run_x + 1;
         }
+        draw_stats.cells_skipped += end_x - start_x + 1 - drawn;
 
-        dirty_endx[y] = 0;
-        dirty_startx[y] = MAXWIDTH;
+        // the hash can only stand for the row once every cell in it is known
+        shadow_hashed[y] = std::find(shadow_color + yp, shadow_color + yp + width, SHADOWUNKNOWN) ==
+                           shadow_color + yp + width;
+        if (shadow_hashed[y])
+            shadow_hash[y] = cells_hash(shadow_text + yp, shadow_color + yp, width);
     }
+    if (!text_runs.empty())
+        draw_text_runs();
 
-    if (!(mode_flags & CURSORINVISIBLE))
+    // when scrolled back the cursor is only drawn if its row is in view
+    y = cursor_y + view_offset;
+    if (!(mode_flags & CURSORINVISIBLE) && y < height)
     {
         x = cursor_x;
         if (x >= width)
@@ -119,20 +172,423 @@ void GTerm::update_changes()
         c = color[yp];
 #ifdef GTERM_PC
         if (mode_flags & PC)
-            DrawCursor((c >> 4) & 0xf, (c >> 8) & 0xf, c & 15, x, cursor_y, text[yp]);
+            DrawCursor((c >> 4) & 0xf, (c >> 8) & 0xf, c & 15, x, y, text[yp]);
         else
 #endif
-            DrawCursor((c >> 4) & 7, (c >> 8) & 7, c & 15, x, cursor_y, text[yp]);
+            DrawCursor((c >> 4) & 7, (c >> 8) & 7, c & 15, x, y, text[yp]);
+        drawn_cursor_x = x;
+        drawn_cursor_y = y;
+        if (cursor_overlay)
+            cursor_shown = 1;
+        else
+            shadow_forget(y, x, x);
+    }
+    else if (cursor_shown)
+    {
+        HideCursor();
+        cursor_shown = 0;
     }
 
     doing_update = 0;
 }
 
-void GTerm::scroll_region(int start_y, int end_y, int num)
+// While parsing only, copies and dirty rows are not kept, but the shadow
+// still holds what was last drawn, as nothing has been drawn since.  So
+// coming back every row is marked dirty, and with the shadow diff only
+// the cells that changed are drawn again.
+void GTerm::SetParseOnly(bool on)
+{
+    int y;
+
+    if (on == (parse_only != 0))
+        return;
+    parse_only = on;
+    if (on)
+        return;
+    // the copies would have moved the shadow along with the pixels
+    pending_view_scroll = 0;
+    pending_scroll = 0;
+    num_pending_shifts = 0;
+    for (y = 0; y < height; y++)
+        dirty_row(y, 0, width - 1);
+}
+
+void GTerm::SetCursorOverlay(bool on)
+{
+    // a cursor drawn into the text is taken out again, and the other way round
+    if (drawn_cursor_y >= 0 && drawn_cursor_y < height)
+    {
+        shadow_forget(drawn_cursor_y, drawn_cursor_x, drawn_cursor_x);
+        dirty_row(drawn_cursor_y, drawn_cursor_x, drawn_cursor_x);
+    }
+    if (cursor_shown)
+        HideCursor();
+    cursor_shown = 0;
+    cursor_overlay = on;
+}
+
+// Draws cells start_x to end_x of row y, as they are in t and row_color,
+// a run for each change of colour or attributes.
+void GTerm::draw_span(int y, int start_x, int end_x, unsigned char *t)
+{
+    int blank, c, nc, x;
+
+    c = row_color[start_x];
+    blank = !(mode_flags & TEXTONLY) && !(c & SELECTED);
+    for (x = start_x; x <= end_x; x++)
+    {
+        nc = row_color[x];
+        if (t[x] != 32 && t[x])
+            blank = 0;
+        if (c != nc)
+        {
+            draw_run(c, blank, start_x, y, x - start_x, t + start_x);
+            start_x = x;
+            c = nc;
+            blank = !(mode_flags & TEXTONLY) && !(c & SELECTED);
+            if (t[x] != 32 && t[x])
+                blank = 0;
+        }
+    }
+    draw_run(c, blank, start_x, y, x - start_x, t + start_x);
+}
+
+// Has the front end copy an area of the screen, and the shadow with it.
+void GTerm::move_chars(int sx, int sy, int dx, int dy, int w, int h)
+{
+    int j, from, to, whole;
+
+    MoveChars(sx, sy, dx, dy, w, h);
+    whole = sx == 0 && dx == 0 && w >= width;
+    for (j = 0; j < h; j++)
+    {
+        // bottom up when moving down, as the rows may overlap
+        from = dy > sy ? sy + h - 1 - j : sy + j;
+        to = dy > sy ? dy + h - 1 - j : dy + j;
+        memmove(shadow_text + to * MAXWIDTH + dx, shadow_text + from * MAXWIDTH + sx, w);
+        memmove(shadow_color + to * MAXWIDTH + dx, shadow_color + from * MAXWIDTH + sx,
+                w * sizeof(uint32_t));
+        shadow_hash[to] = shadow_hash[from];
+        shadow_hashed[to] = whole && shadow_hashed[from];
+    }
+}
+
+// Marks cells of row y as not necessarily showing what the shadow says, so
+// update_changes draws them the next time they are dirty.
+void GTerm::shadow_forget(int y, int start_x, int end_x)
+{
+    if (y < 0 || y >= MAXHEIGHT)
+        return;
+    start_x = max(start_x, 0);
+    end_x = min(end_x, MAXWIDTH - 1);
+    if (start_x > end_x)
+        return;
+    std::fill(shadow_color + y * MAXWIDTH + start_x, shadow_color + y * MAXWIDTH + end_x + 1,
+              (uint32_t)SHADOWUNKNOWN);
+    shadow_hashed[y] = 0;
+}
+
+void GTerm::shadow_forget_all()
+{
+    std::fill(shadow_color, shadow_color + MAXWIDTH * MAXHEIGHT, (uint32_t)SHADOWUNKNOWN);
+    memset(shadow_hashed, 0, sizeof(shadow_hashed));
+}
+
+// FNV-1a over n cells, a cell at a time
+uint64_t GTerm::cells_hash(const unsigned char *t, const uint32_t *c, int n)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    int x;
+
+    for (x = 0; x < n; x++)
+        hash = (hash ^ ((uint64_t)c[x] << 8 | t[x])) * 1099511628211ULL;
+    return hash;
+}
+
+// Fetches row y as it is to be drawn: its text into t and its colours, with
+// the selection, into row_color.
+void GTerm::shown_row(int y, unsigned char *&t)
+{
+    unsigned short *c;
+    int x, sel_row, sel_sx, sel_ex;
+
+    row_source(y, t, c);
+    // the selection is drawn here rather than stored in the cells
+    sel_row = selection_span(sel, view_top(), y, sel_sx, sel_ex);
+    for (x = 0; x < width; x++)
+    {
+        row_color[x] = c[x];
+        if (sel_row && x >= sel_sx && x <= sel_ex)
+            row_color[x] |= SELECTED;
+        // as is blinking, by blanking the text in its off phase
+        if (blink_hidden && c[x] & BLINK && t[x] != ' ' && t[x] && !(mode_flags & PC))
+        {
+            if (t != blink_text)
+            {
+                memcpy(blink_text, t, width);
+                t = blink_text;
+            }
+            blink_text[x] = ' ';
+        }
+    }
+}
+
+// Sets the blinking flag of screen row y from its first w cells.
+void GTerm::note_blinking(int y, int w)
+{
+    int x, yp = linenumbers[y] * MAXWIDTH;
+
+    blinking[linenumbers[y]] = 0;
+    for (x = 0; x < w; x++)
+        if (color[yp + x] & BLINK && text[yp + x] != ' ' && text[yp + x])
+        {
+            blinking[linenumbers[y]] = 1;
+            return;
+        }
+}
+
+bool GTerm::HasBlinkText()
+{
+    int y;
+
+    if (mode_flags & PC)
+        return false;
+    for (y = 0; y < height; y++)
+        if (blinking[linenumbers[y]])
+            return true;
+    return false;
+}
+
+// Only the rows in the blinking index are looked at, and those found to
+// have no blinking text left are taken out of it.  While scrolled back,
+// history rows are looked at too, but stay blank if they are hidden as
+// the view moves.
+bool GTerm::BlinkText(bool hidden)
+{
+    unsigned char *t;
+    unsigned short *c;
+    int y, x, start_x, line, row_found, found = 0;
+
+    if (hidden == (blink_hidden != 0) || mode_flags & PC)
+        return false;
+    blink_hidden = hidden;
+    for (y = 0; y < height; y++)
+    {
+        line = y - view_offset; // the screen row shown here, or history if negative
+        if (line >= 0 && !blinking[linenumbers[line]])
+            continue;
+        row_source(y, t, c);
+        start_x = -1;
+        row_found = 0;
+        for (x = 0; x <= width; x++)
+        {
+            if (x < width && c[x] & BLINK && t[x] != ' ' && t[x])
+            {
+                if (start_x < 0)
+                    start_x = x;
+                continue;
+            }
+            if (start_x >= 0)
+            {
+                dirty_row(y, start_x, x - 1);
+                row_found = found = 1;
+                start_x = -1;
+            }
+        }
+        if (line >= 0 && !row_found)
+            blinking[linenumbers[line]] = 0;
+    }
+    return found != 0;
+}
+
+// Combines the row hashes of the TILEHEIGHT rows from y in tile column tx.
+uint64_t GTerm::tile_hash(const std::vector<uint64_t> &rows, int y, int tx)
+{
+    uint64_t hash = 14695981039346656037ULL ^ (uint64_t)tx;
+    int i;
+
+    for (i = 0; i < TILEHEIGHT; i++)
+        hash = (hash ^ rows[(y + i) * TILECOLUMNS + tx]) * 1099511628211ULL;
+    return hash;
+}
+
+// Splits the screen into tiles of TILEHEIGHT rows by TILEWIDTH columns.  A
+// dirty tile whose contents are shown elsewhere in its columns, as after an
+// application redraws a scrolled screen itself, is copied from there; the
+// cells update_changes then finds already match the shadow and are skipped.
+// Copies must read what was shown before any of them, so each waits for
+// those reading from its destination; copies waiting on each other are
+// dropped and their cells drawn instead.
+void GTerm::reuse_tiles()
+{
+    struct TileCopy
+    {
+        int tx, sy, dy;
+    };
+    TileCopy copies[MAXHEIGHT / TILEHEIGHT * TILECOLUMNS];
+    int tiles_y, tiles_x, ty, tx, y, x, w, yp, n, i, j, dirty, left;
+    unsigned char *t;
+    uint64_t hash;
+    bool sources_built = false;
+
+    tiles_y = height / TILEHEIGHT; // a part tile at the bottom is left to the cells
+    tiles_x = (width + TILEWIDTH - 1) / TILEWIDTH;
+    n = 0;
+    for (ty = 0; ty < tiles_y; ty++)
+    {
+        // hash the rows to be drawn, if any tile in them is dirty
+        for (y = ty * TILEHEIGHT; y < (ty + 1) * TILEHEIGHT; y++)
+            if (dirty_startx[y] < MAXWIDTH && dirty_startx[y] <= dirty_endx[y])
+                break;
+        if (y == (ty + 1) * TILEHEIGHT)
+            continue;
+        for (y = ty * TILEHEIGHT; y < (ty + 1) * TILEHEIGHT; y++)
+        {
+            shown_row(y, t);
+            for (tx = 0, x = 0; tx < tiles_x; tx++, x += TILEWIDTH)
+                new_tile_rows[y * TILECOLUMNS + tx] = cells_hash(t + x, row_color + x, min(TILEWIDTH, width - x));
+        }
+
+        for (tx = 0, x = 0; tx < tiles_x; tx++, x += TILEWIDTH)
+        {
+            dirty = 0;
+            for (y = ty * TILEHEIGHT; y < (ty + 1) * TILEHEIGHT && !dirty; y++)
+                dirty = dirty_startx[y] <= x + TILEWIDTH - 1 && dirty_endx[y] >= x &&
+                        dirty_startx[y] < MAXWIDTH;
+            if (!dirty)
+                continue;
+            draw_stats.tiles_dirty++;
+
+            if (!sources_built)
+            {
+                // every tile-sized area of the shadow, at any row
+                for (y = 0; y < height; y++)
+                    for (i = 0, yp = y * MAXWIDTH; i < tiles_x; i++)
+                    {
+                        w = min(TILEWIDTH, width - i * TILEWIDTH);
+                        shadow_tile_rows[y * TILECOLUMNS + i] =
+                            cells_hash(shadow_text + yp + i * TILEWIDTH, shadow_color + yp + i * TILEWIDTH, w);
+                    }
+                tile_sources.clear();
+                for (y = 0; y + TILEHEIGHT <= height; y++)
+                    for (i = 0; i < tiles_x; i++)
+                        tile_sources.emplace(tile_hash(shadow_tile_rows, y, i), y);
+                sources_built = true;
+            }
+
+            hash = tile_hash(new_tile_rows, ty * TILEHEIGHT, tx);
+            if (hash == tile_hash(shadow_tile_rows, ty * TILEHEIGHT, tx))
+            {
+                draw_stats.tiles_unchanged++;
+                continue;
+            }
+            auto found = tile_sources.find(hash);
+            if (found != tile_sources.end())
+                copies[n++] = {tx, found->second, ty * TILEHEIGHT};
+        }
+    }
+
+    for (left = n; left;)
+    {
+        for (i = 0; i < n; i++)
+        {
+            if (copies[i].tx < 0)
+                continue;
+            for (j = 0; j < n; j++)
+                if (j != i && copies[j].tx == copies[i].tx && copies[j].sy < copies[i].dy + TILEHEIGHT &&
+                    copies[i].dy < copies[j].sy + TILEHEIGHT)
+                    break;
+            if (j < n)
+                continue;
+            x = copies[i].tx * TILEWIDTH;
+            move_chars(x, copies[i].sy, x, copies[i].dy, min(TILEWIDTH, width - x), TILEHEIGHT);
+            draw_stats.tiles_moved++;
+            copies[i].tx = -1;
+            left--;
+            break;
+        }
+        if (i == n)
+        {
+            // every copy left waits on another
+            for (i = 0; copies[i].tx < 0; i++)
+                ;
+            copies[i].tx = -1;
+            left--;
+        }
+    }
+}
+
+void GTerm::SetShadowDiff(bool on)
+{
+    // nothing was recorded while it was off
+    if (on && !shadow_diff)
+        shadow_forget_all();
+    shadow_diff = on;
+}
+
+void GTerm::run_colors(int c, int &fg, int &bg)
+{
+#ifdef GTERM_PC
+    if (mode_flags & PC)
+    {
+        fg = (c >> 4) & 0xf;
+        bg = (c >> 8) & 0xf;
+        return;
+    }
+#endif
+    fg = (c >> 4) & 7;
+    bg = (c >> 8) & 7;
+}
+
+// Draws len characters of colour c from row y, or clears them if blank.
+// In two-pass mode only the background is filled now, and the text is
+// kept for draw_text_runs.
+void GTerm::draw_run(int c, int blank, int x, int y, int len, unsigned char *t)
+{
+    int fg, bg;
+
+    if (blank)
+    {
+        ClearChars((c >> 8) & 7, x, y, len, 1);
+        return;
+    }
+    run_colors(c, fg, bg);
+    if (!two_pass_draw)
+    {
+        DrawText(fg, bg, c /*&15*/, x, y, len, t);
+        return;
+    }
+    ClearChars(TextBackground(fg, bg, c), x, y, len, 1);
+    // t may be a history line padded in view_text, reused for the next row
+    text_runs.push_back({c, x, y, len, run_text.size()});
+    run_text.insert(run_text.end(), t, t + len);
+    run_text.push_back(0);
+}
+
+// Draws the text held back by draw_run, over the backgrounds already
+// cleared.  Runs of the same colours and attributes are drawn together so
+// the front end changes fonts and colours as little as possible.
+void GTerm::draw_text_runs()
+{
+    int fg, bg;
+
+    std::stable_sort(text_runs.begin(), text_runs.end(),
+                     [](const TextRun &a, const TextRun &b) { return a.c < b.c; });
+    for (TextRun &r : text_runs)
+    {
+        run_colors(r.c, fg, bg);
+        DrawText(fg, bg, r.c | BACKGROUNDDRAWN, r.x, r.y, r.len, run_text.data() + r.offset);
+    }
+    text_runs.clear();
+    run_text.clear();
+}
+
+void GTerm::scroll_region(int start_y, int end_y, int num, bool line_feed)
 {
     int y, takey, fast_scroll, mx, clr, x, yp, c;
     short temp[MAXHEIGHT];
     uint16_t temp_sx[MAXHEIGHT], temp_ex[MAXHEIGHT];
+    int64_t old_scrolled;
 
     if (!num)
         return;
@@ -142,12 +598,39 @@ void GTerm::scroll_region(int start_y, int end_y, int num)
     if (-num > mx)
         num = -mx;
 
-    fast_scroll = (start_y == scroll_top && end_y == scroll_bot && !(mode_flags & TEXTONLY));
+    old_scrolled = scrolled_lines;
+    // lines deleted, or scrolled out of a region, never scrolled off the screen
+    if (line_feed && start_y == 0 && end_y == height - 1 && num > 0)
+    {
+        if (!alt_screen)
+            for (y = 0; y < num; y++)
+                push_history(y);
+        scrolled_lines += num;
+    }
+
+    // a pending horizontal copy must not be applied to lines that have moved
+    flush_pending_shifts();
+
+    // while scrolled back, the rows in view are simply redrawn
+    fast_scroll = (start_y == scroll_top && end_y == scroll_bot && !(mode_flags & TEXTONLY) &&
+                   !view_offset && !parse_only);
+    if (view_offset && drawn_cursor_y >= 0)
+    {
+        dirty_row(drawn_cursor_y, drawn_cursor_x, drawn_cursor_x);
+        drawn_cursor_y = -1;
+    }
 
     if (fast_scroll)
         pending_scroll += num;
 
-    memcpy(temp, linenumbers, sizeof(linenumbers));
+    if (drawn_cursor_y >= start_y && drawn_cursor_y <= end_y)
+    {
+        drawn_cursor_y -= num;
+        if (!fast_scroll || drawn_cursor_y < start_y || drawn_cursor_y > end_y)
+            drawn_cursor_y = -1;
+    }
+
+    memcpy(temp, linenumbers, sizeof(temp));
     if (fast_scroll)
     {
         memcpy(temp_sx, dirty_startx, sizeof(dirty_startx));
@@ -170,8 +653,7 @@ void GTerm::scroll_region(int start_y, int end_y, int num)
             linenumbers[y] = temp[takey];
             if (!fast_scroll || clr)
             {
-                dirty_startx[y] = 0;
-                dirty_endx[y] = width - 1;
+                changed_line(y, 0, width - 1);
             }
             else
             {
@@ -180,6 +662,8 @@ void GTerm::scroll_region(int start_y, int end_y, int num)
             }
             if (clr)
             {
+                wrapped[linenumbers[y]] = 0;
+                blinking[linenumbers[y]] = 0;
                 yp = linenumbers[y] * MAXWIDTH;
                 memset(text + yp, 32, width);
                 for (x = 0; x < width; x++)
@@ -188,11 +672,27 @@ void GTerm::scroll_region(int start_y, int end_y, int num)
                 }
             }
         }
+
+    if (view_offset)
+    {
+        // stay on the same lines, unless they have dropped out of history
+        view_offset += scrolled_lines - old_scrolled;
+        if (view_offset > (int)history.size())
+        {
+            view_offset = history.size();
+            ExposeAll();
+        }
+        else
+            for (y = 0; y < height; y++)
+                changed_line(y, 0, width - 1);
+    }
+    else if (sel.active)
+        selection_scrolled(start_y, end_y, num, old_scrolled);
 }
 
 void GTerm::shift_text(int y, int start_x, int end_x, int num)
 {
-    int x, yp, mx, c;
+    int x, yp, mx, c, n, sx, ex, i;
 
     if (!num)
         return;
@@ -221,19 +721,444 @@ void GTerm::shift_text(int y, int start_x, int end_x, int num)
 
     if (num < 0)
     {
-        x = yp + end_x + num + 1;
+        x = end_x + num + 1;
     }
     else
     {
-        x = yp + start_x;
+        x = start_x;
     }
-    num = abs(num);
-    memset(text + x, 32, num);
+    n = abs(num);
+    memset(text + yp + x, 32, n);
     c = calc_color(fg_color, bg_color, mode_flags);
-    while (num--)
-        color[x++] = c;
+    for (i = 0; i < n; i++)
+        color[yp + x + i] = c;
+
+    if ((mode_flags & TEXTONLY) || n == mx || num_pending_shifts == MAXPENDINGSHIFTS || view_offset ||
+        parse_only)
+    {
+        changed_line(y, start_x, end_x);
+        return;
+    }
+
+    // Let update_changes copy what is already on screen instead of
+    // redrawing the whole span.  Cells that were waiting to be redrawn
+    // move along with the copy, as does the cursor image.
+    PendingShift &s = pending_shifts[num_pending_shifts++];
+    s.y = y;
+    s.start_x = start_x;
+    s.end_x = end_x;
+    s.num = num;
+
+    sx = dirty_startx[y];
+    ex = dirty_endx[y];
+    dirty_startx[y] = MAXWIDTH;
+    dirty_endx[y] = 0;
+    if (sx <= ex)
+    {
+        if (sx < start_x)
+            changed_line(y, sx, min(ex, start_x - 1));
+        if (ex > end_x)
+            changed_line(y, max(sx, end_x + 1), ex);
+        sx = max(sx, start_x) + num;
+        ex = min(ex, end_x) + num;
+        if (sx < start_x)
+            sx = start_x;
+        if (ex > end_x)
+            ex = end_x;
+        if (sx <= ex)
+            changed_line(y, sx, ex);
+    }
+    if (y == drawn_cursor_y && drawn_cursor_x >= start_x && drawn_cursor_x <= end_x)
+    {
+        drawn_cursor_x += num;
+        if (drawn_cursor_x < start_x || drawn_cursor_x > end_x)
+            drawn_cursor_y = -1;
+    }
+    changed_line(y, x, x + n - 1);
+    // the copy drags the selection highlight along with the text
+    if (selection_span(sel, view_top(), y, sx, ex))
+        changed_line(y, start_x, end_x);
+}
+
+bool GTerm::sync_held()
+{
+    if (!sync_update)
+        return false;
+    if (chrono::steady_clock::now() < sync_deadline)
+        return true;
+    // the end marker never came; don't leave the screen frozen
+    sync_update = 0;
+    return false;
+}
+
+void GTerm::expose_pending_scroll()
+{
+    int y;
+
+    // the region is about to change, so the copy can't wait for update_changes
+    if (!pending_scroll)
+        return;
+    for (y = scroll_top; y <= scroll_bot; y++)
+        changed_line(y, 0, width - 1);
+    pending_scroll = 0;
+}
+
+// Finds the columns of screen row y that s covers, taking row y to be line
+// scrolled + y.
+bool GTerm::selection_span(const Selection &s, int64_t scrolled, int y, int &sx, int &ex)
+{
+    int64_t line, l1, l2;
+    int x1, x2;
+
+    if (!s.active)
+        return false;
+    if (s.anchor_line < s.extent_line ||
+        (s.anchor_line == s.extent_line && s.anchor_x <= s.extent_x))
+    {
+        l1 = s.anchor_line;
+        x1 = s.anchor_x;
+        l2 = s.extent_line;
+        x2 = s.extent_x;
+    }
+    else
+    {
+        l1 = s.extent_line;
+        x1 = s.extent_x;
+        l2 = s.anchor_line;
+        x2 = s.anchor_x;
+    }
+    if (l1 == l2 && x1 == x2)
+        return false;
+
+    line = scrolled + y;
+    if (line < l1 || line > l2)
+        return false;
+    sx = (line == l1) ? x1 : 0;
+    ex = (line == l2) ? x2 : width - 1;
+    return sx <= ex;
+}
+
+// Replaces the selection, redrawing only the rows where it differs.
+void GTerm::set_selection(const Selection &s)
+{
+    int y, a, b, sx1, ex1, sx2, ex2;
+
+    for (y = 0; y < height; y++)
+    {
+        a = selection_span(sel, view_top(), y, sx1, ex1);
+        b = selection_span(s, view_top(), y, sx2, ex2);
+        if (a && b && sx1 == sx2 && ex1 == ex2)
+            continue;
+        if (a)
+            dirty_row(y, sx1, ex1);
+        if (b)
+            dirty_row(y, sx2, ex2);
+    }
+    sel = s;
+}
+
+// After a scroll, redraws rows where the highlight the blit left behind no
+// longer matches the selection.
+void GTerm::selection_scrolled(int start_y, int end_y, int num, int64_t old_scrolled)
+{
+    int y, from, a, b, sx1, ex1, sx2, ex2;
+
+    for (y = 0; y < height; y++)
+    {
+        from = y;
+        if (y >= start_y && y <= end_y)
+        {
+            from = y + num;
+            if (from < start_y || from > end_y)
+                continue; // cleared, so redrawn anyway
+        }
+        a = selection_span(sel, old_scrolled, from, sx1, ex1);
+        b = selection_span(sel, scrolled_lines, y, sx2, ex2);
+        if (a && b && sx1 == sx2 && ex1 == ex2)
+            continue;
+        if (a)
+            changed_line(y, sx1, ex1);
+        if (b)
+            changed_line(y, sx2, ex2);
+    }
+}
+
+void GTerm::push_history(int y)
+{
+    int yp;
+
+    if (history_size <= 0)
+        return;
+    HistoryLine &line = new_history_line();
+    yp = linenumbers[y] * MAXWIDTH;
+    line.text.assign(text + yp, text + yp + width);
+    line.color.assign(color + yp, color + yp + width);
+    line.wrapped = wrapped[linenumbers[y]];
+}
+
+// Adds a line to the end of history for the caller to fill in.  When
+// history is full the oldest line is dropped and its storage reused.
+GTerm::HistoryLine &GTerm::new_history_line()
+{
+    HistoryLine line;
+
+    if ((int)(history.size() + history_old.size()) >= history_size)
+    {
+        if (!history_old.empty())
+        {
+            line = std::move(history_old.front());
+            history_old.pop_front();
+        }
+        else if (!history.empty())
+        {
+            line = std::move(history.front());
+            history.pop_front();
+        }
+    }
+    history.push_back(std::move(line));
+    return history.back();
+}
+
+// Joins lines first to last, one logical line, and wraps it again at width
+// w onto the end of out.  If the cursor is at column cur_x of line cur_line
+// its new place is returned in *row (counting in out) and *x.
+void GTerm::rewrap(std::deque<HistoryLine> &lines, int first, int last, int w, std::deque<HistoryLine> &out,
+                   int cur_line, int cur_x, int *row, int *x)
+{
+    std::vector<unsigned char> t;
+    std::vector<unsigned short> c;
+    int i, n, r, rows, off, s, e, blank;
+
+    off = -1;
+    for (i = first; i <= last; i++)
+    {
+        if (i == cur_line)
+            off = t.size() + cur_x;
+        t.insert(t.end(), lines[i].text.begin(), lines[i].text.end());
+        c.insert(c.end(), lines[i].color.begin(), lines[i].color.end());
+    }
+    // trailing blanks are kept only if the line goes on past these
+    n = t.size();
+    if (!lines[last].wrapped)
+        while (n > 0 && (t[n - 1] == ' ' || !t[n - 1]))
+            n--;
+    rows = (n + w - 1) / w;
+    if (off >= 0)
+    {
+        rows = max(rows, off / w + 1);
+        *row = out.size() + off / w;
+        *x = off % w;
+    }
+    if (rows < 1)
+        rows = 1;
 
-    changed_line(y, start_x, end_x);
+    blank = calc_color(7, 0, 0);
+    for (r = 0; r < rows; r++)
+    {
+        HistoryLine line;
+        line.text.assign(w, 32);
+        line.color.assign(w, blank);
+        s = r * w;
+        e = min(n, s + w);
+        if (e > s)
+        {
+            memcpy(line.text.data(), t.data() + s, e - s);
+            memcpy(line.color.data(), c.data() + s, (e - s) * sizeof(unsigned short));
+        }
+        line.wrapped = r < rows - 1 || lines[last].wrapped;
+        out.push_back(std::move(line));
+    }
+}
+
+// Rewraps the main screen for a width of w and height of h.  A line that
+// wrapped from history onto the screen goes with it, and lines pushed off
+// the top go to history; the rest of history is left for reflow_history.
+void GTerm::reflow_screen(int w, int h)
+{
+    std::deque<HistoryLine> in, out;
+    int x, y, i, first, last, from_history, cur_row, cur_x, excess, yp;
+
+    while (!history.empty() && history.back().wrapped)
+    {
+        in.push_front(std::move(history.back()));
+        history.pop_back();
+    }
+    from_history = in.size();
+    scrolled_lines -= from_history;
+    if (history_old.empty())
+        history_old.swap(history);
+    else
+        while (!history.empty())
+        {
+            history_old.push_back(std::move(history.front()));
+            history.pop_front();
+        }
+
+    // blank rows below the cursor are left out
+    last = cursor_y;
+    for (y = height - 1; y > last; y--)
+    {
+        yp = linenumbers[y] * MAXWIDTH;
+        for (x = 0; x < width && (text[yp + x] == ' ' || !text[yp + x]); x++)
+            ;
+        if (x < width)
+            last = y;
+    }
+    for (y = 0; y <= last; y++)
+    {
+        HistoryLine line;
+        yp = linenumbers[y] * MAXWIDTH;
+        line.text.assign(text + yp, text + yp + width);
+        line.color.assign(color + yp, color + yp + width);
+        line.wrapped = wrapped[linenumbers[y]];
+        in.push_back(std::move(line));
+    }
+
+    cur_row = cur_x = 0;
+    for (first = 0; first < (int)in.size(); first = last + 1)
+    {
+        for (last = first; last < (int)in.size() - 1 && in[last].wrapped; last++)
+            ;
+        rewrap(in, first, last, w, out, from_history + cursor_y, min(cursor_x, width), &cur_row, &cur_x);
+    }
+
+    excess = max(0, (int)out.size() - h);
+    for (i = 0; i < excess; i++)
+        if (history_size > 0)
+            new_history_line() = std::move(out[i]);
+    scrolled_lines += excess;
+
+    clear_area(0, 0, MAXWIDTH - 1, MAXHEIGHT - 1);
+    for (y = 0; y < h && excess + y < (int)out.size(); y++)
+    {
+        HistoryLine &line = out[excess + y];
+        yp = linenumbers[y] * MAXWIDTH;
+        memcpy(text + yp, line.text.data(), w);
+        memcpy(color + yp, line.color.data(), w * sizeof(unsigned short));
+        wrapped[linenumbers[y]] = line.wrapped;
+        note_blinking(y, w);
+    }
+    cursor_x = min(cur_x, w - 1);
+    cursor_y = max(0, min(cur_row - excess, h - 1));
+    sel.active = 0;
+}
+
+// Rewraps the newest logical line from before the last width change onto
+// the front of history.  Returns false when there are none left.
+bool GTerm::reflow_history()
+{
+    std::deque<HistoryLine> out;
+    int first, last, row, x;
+
+    if (history_old.empty())
+        return false;
+    last = history_old.size() - 1;
+    for (first = last; first > 0 && history_old[first - 1].wrapped; first--)
+        ;
+    rewrap(history_old, first, last, width, out, -1, 0, &row, &x);
+    history_old.erase(history_old.begin() + first, history_old.end());
+    while (!out.empty())
+    {
+        history.push_front(std::move(out.back()));
+        out.pop_back();
+    }
+    // a narrower width takes more lines
+    while ((int)(history.size() + history_old.size()) > history_size)
+    {
+        if (!history_old.empty())
+            history_old.pop_front();
+        else
+            history.pop_front();
+    }
+    return true;
+}
+
+// Finds the text and colors shown on row y of the view.
+void GTerm::row_source(int y, unsigned char *&t, unsigned short *&c)
+{
+    int n, x;
+
+    if (y >= view_offset)
+    {
+        t = text + linenumbers[y - view_offset] * MAXWIDTH;
+        c = color + linenumbers[y - view_offset] * MAXWIDTH;
+        return;
+    }
+    HistoryLine &h = history[history.size() - view_offset + y];
+    n = h.text.size();
+    if (n >= width)
+    {
+        t = h.text.data();
+        c = h.color.data();
+        return;
+    }
+    // the line is from when the screen was narrower
+    memcpy(view_text, h.text.data(), n);
+    memcpy(view_color, h.color.data(), n * sizeof(unsigned short));
+    memset(view_text + n, 32, width - n);
+    for (x = n; x < width; x++)
+        view_color[x] = calc_color(7, 0, 0);
+    t = view_text;
+    c = view_color;
+}
+
+void GTerm::flush_pending_shifts()
+{
+    int i;
+
+    for (i = 0; i < num_pending_shifts; i++)
+        changed_line(pending_shifts[i].y, pending_shifts[i].start_x, pending_shifts[i].end_x);
+    num_pending_shifts = 0;
+}
+
+void GTerm::swap_screens()
+{
+    int i;
+
+    if (!alt_text)
+    {
+        alt_text = new unsigned char[MAXWIDTH * MAXHEIGHT];
+        alt_color = new unsigned short[MAXWIDTH * MAXHEIGHT];
+        alt_linenumbers = new short[MAXHEIGHT];
+        alt_wrapped = new unsigned char[MAXHEIGHT];
+        memset(alt_wrapped, 0, MAXHEIGHT);
+        alt_blinking = new unsigned char[MAXHEIGHT];
+        memset(alt_blinking, 0, MAXHEIGHT);
+        memset(alt_text, 32, MAXWIDTH * MAXHEIGHT);
+        for (i = 0; i < MAXWIDTH * MAXHEIGHT; i++)
+            alt_color[i] = calc_color(7, 0, 0);
+        for (i = 0; i < MAXHEIGHT; i++)
+            alt_linenumbers[i] = i;
+    }
+
+    std::swap(text, alt_text);
+    std::swap(color, alt_color);
+    std::swap(linenumbers, alt_linenumbers);
+    std::swap(wrapped, alt_wrapped);
+    std::swap(blinking, alt_blinking);
+    // the lines are numbered alike on both screens
+    for (i = 0; i < MAXHEIGHT; i++)
+        line_version[i] = ++version_clock;
+    std::swap(scrolled_lines, alt_scrolled_lines);
+}
+
+// Shows the alternate screen (alt != 0) or the normal one.  Only pointers
+// are exchanged; whatever was drawn for the old screen is thrown away and
+// the new one is exposed.
+void GTerm::switch_screen(int alt)
+{
+    if (!alt == !alt_screen)
+        return;
+
+    swap_screens();
+    alt_screen = alt;
+    sel.active = 0;
+    view_offset = 0; // the alternate screen has no history
+    pending_view_scroll = 0;
+
+    pending_scroll = 0;
+    num_pending_shifts = 0;
+    ExposeAll();
 }
 
 void GTerm::clear_area(int start_x, int start_y, int end_x, int end_y)
@@ -248,6 +1173,11 @@ void GTerm::clear_area(int start_x, int start_y, int end_x, int end_y)
 
     for (y = start_y; y <= end_y; y++)
     {
+        // erasing the end of a row breaks it from the next one
+        if (end_x >= width - 1)
+            wrapped[linenumbers[y]] = 0;
+        if (start_x == 0 && end_x >= width - 1)
+            blinking[linenumbers[y]] = 0;
         yp = linenumbers[y] * MAXWIDTH;
         memset(text + yp + start_x, 32, w);
         for (x = start_x; x <= end_x; x++)
@@ -260,6 +1190,21 @@ void GTerm::clear_area(int start_x, int start_y, int end_x, int end_y)
 
 void GTerm::changed_line(int y, int start_x, int end_x)
 {
+    line_version[linenumbers[y]] = ++version_clock;
+    // while scrolled back, screen row y is shown further down, if at all
+    if (view_offset)
+    {
+        y += view_offset;
+        if (y >= height)
+            return;
+    }
+    dirty_row(y, start_x, end_x);
+}
+
+void GTerm::dirty_row(int y, int start_x, int end_x)
+{
+    if (parse_only)
+        return;
     if (dirty_startx[y] > start_x)
         dirty_startx[y] = start_x;
     if (dirty_endx[y] < end_x)
@@ -270,7 +1215,9 @@ void GTerm::move_cursor(int x, int y)
 {
     if (cursor_x >= width)
         cursor_x = width - 1;
-    changed_line(cursor_y, cursor_x, cursor_x);
+    // an overlay cursor leaves the cell as it was
+    if (!cursor_overlay)
+        changed_line(cursor_y, cursor_x, cursor_x);
     cursor_x = x;
     cursor_y = y;
 }
@@ -0,0 +1,692 @@
+/*
+    taTelnet - A cross-platform telnet program.
+
+License: wxWindows License Version 3.1 (See the file license3.txt)
+
+*/
+
+// For compilers that support precompilation, includes "wx/wx.h".
+#include "wx/wxprec.h"
+
+#ifdef __BORLANDC__
+#pragma hdrstop
+#endif
+
+#include <wx/brush.h>
+#include <wx/dcmemory.h>
+#include <wx/rawbmp.h>
+
+#include <algorithm>
+#include <string.h>
+
+// below this many queued cells, handing out stripes costs more than it saves
+#define PARALLEL_MIN_CELLS 2048
+#define PARALLEL_MIN_PIXELS (256 * 1024)
+#define MAX_THREADS 16
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "pixelrenderer.h"
+
+static inline uint32_t PackColour(const wxColour &c)
+{
+    return ((uint32_t)c.Red() << 16) | ((uint32_t)c.Green() << 8) | c.Blue();
+}
+
+#ifdef __SSE2__
+// (fg * a + d * (255 - a)) / 255, rounded, in each 16 bit lane
+static inline __m128i BlendLanes(__m128i d, __m128i a, __m128i fg, __m128i max, __m128i half)
+{
+    __m128i x = _mm_add_epi16(_mm_mullo_epi16(fg, a), _mm_mullo_epi16(d, _mm_sub_epi16(max, a)));
+
+    x = _mm_add_epi16(x, half);
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+///  BlendOver
+///  Blends fg over n pixels, each by its coverage (0 to 255)
+///
+///  @param  dst uint32_t *            The pixels
+///  @param  cov const unsigned char * Their coverage
+///  @param  n   int                   How many pixels
+///  @param  fg  uint32_t              The colour, as 0x00RRGGBB
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+static void BlendOver(uint32_t *dst, const unsigned char *cov, int n, uint32_t fg)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i max = _mm_set1_epi16(255);
+    const __m128i half = _mm_set1_epi16(128);
+    const __m128i fg16 = _mm_unpacklo_epi8(_mm_set1_epi32((int)fg), zero);
+
+    for (; i + 4 <= n; i += 4)
+    {
+        int32_t c4;
+
+        memcpy(&c4, cov + i, 4);
+        if (!c4)
+            continue;
+        // spread each pixel's coverage over its four bytes
+        __m128i a = _mm_cvtsi32_si128(c4);
+        a = _mm_unpacklo_epi8(a, a);
+        a = _mm_unpacklo_epi16(a, a);
+
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i lo = BlendLanes(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(a, zero), fg16, max, half);
+        __m128i hi = BlendLanes(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(a, zero), fg16, max, half);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    for (; i < n; i++)
+    {
+        uint32_t a = cov[i], d = dst[i], out = 0;
+        int shift;
+
+        if (!a)
+            continue;
+        for (shift = 0; shift < 24; shift += 8)
+        {
+            uint32_t x = ((fg >> shift) & 255) * a + ((d >> shift) & 255) * (255 - a) + 128;
+            out |= ((x + (x >> 8)) >> 8) << shift;
+        }
+        dst[i] = out;
+    }
+}
+
+PixelGlyphs::PixelGlyphs()
+{
+    m_cellWidth = m_cellHeight = 1;
+    m_charMap = nullptr;
+    m_sets = 0;
+}
+
+void PixelGlyphs::Clear()
+{
+    int i;
+
+    for (i = 0; i < 8; i++)
+        m_atlas[i].clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public SetFonts
+///  Sets the fonts for each style, throwing away glyphs from the old ones
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void PixelGlyphs::SetFonts(const wxFont &normal, const wxFont &underlined, const wxFont &bold,
+                           const wxFont &boldUnderlined)
+{
+    m_fonts[0] = normal;
+    m_fonts[PixelRenderer::STYLE_UNDERLINE] = underlined;
+    m_fonts[PixelRenderer::STYLE_BOLD] = bold;
+    m_fonts[PixelRenderer::STYLE_BOLD | PixelRenderer::STYLE_UNDERLINE] = boldUnderlined;
+    Clear();
+}
+
+void PixelGlyphs::SetCharMap(const unsigned char *map)
+{
+    if (map != m_charMap)
+    {
+        m_charMap = map;
+        Clear();
+    }
+}
+
+void PixelGlyphs::SetCellSize(int cellWidth, int cellHeight)
+{
+    if (cellWidth != m_cellWidth || cellHeight != m_cellHeight)
+    {
+        m_cellWidth = cellWidth;
+        m_cellHeight = cellHeight;
+        Clear();
+    }
+}
+
+size_t PixelGlyphs::GetMemory()
+{
+    size_t bytes = 0;
+    int i;
+
+    for (i = 0; i < 8; i++)
+        bytes += m_atlas[i].capacity();
+    return bytes;
+}
+
+PixelRenderer::PixelRenderer()
+{
+    m_width = m_height = 0;
+    m_cellWidth = m_cellHeight = 1;
+    m_glyphs = &m_ownGlyphs;
+    m_damageX1 = m_damageY1 = m_damageX2 = m_damageY2 = 0;
+    m_threads = 1;
+    m_job = nullptr;
+    m_jobStripes = m_pending = 0;
+    m_generation = 0;
+    m_quit = false;
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+PixelRenderer::~PixelRenderer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_quit = true;
+    }
+    m_wake.notify_all();
+    for (std::thread &t : m_workers)
+        t.join();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public SetThreads
+///  Sets how many threads draw; 1 draws straight away on the caller's.
+///  Workers are started the first time there is enough queued to use them
+///
+///  @param  threads int  The number of threads, including the caller's
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void PixelRenderer::SetThreads(int threads)
+{
+    Render();
+    m_threads = std::max(1, std::min(threads, MAX_THREADS));
+}
+
+PixelRenderer::Stats PixelRenderer::GetStats()
+{
+    Stats stats = m_stats;
+
+    stats.glyphSets = m_glyphs->GetSets();
+    return stats;
+}
+
+size_t PixelRenderer::GetMemory()
+{
+    return m_pixels.capacity() * sizeof(uint32_t) + m_ops.capacity() * sizeof(Op) + m_opText.capacity() +
+           m_ownGlyphs.GetMemory();
+}
+
+void PixelRenderer::WorkerMain(int id, unsigned generation)
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    unsigned seen = generation; // the last job before this worker started
+
+    for (;;)
+    {
+        m_wake.wait(lock, [&] { return m_quit || m_generation != seen; });
+        if (m_quit)
+            return;
+        seen = m_generation;
+        if (id + 1 >= m_jobStripes)
+            continue;
+        lock.unlock();
+        (*m_job)(id + 1);
+        lock.lock();
+        if (--m_pending == 0)
+            m_done.notify_one();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private RunStripes
+///  Runs a job for each stripe, stripe 0 on this thread and the rest on the
+///  workers, and waits for them all
+///
+///  @param  stripes int                              How many stripes
+///  @param  job     const std::function<void(int)> & Draws the stripe it is given
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void PixelRenderer::RunStripes(int stripes, const std::function<void(int)> &job)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        while ((int)m_workers.size() < stripes - 1)
+            m_workers.emplace_back(&PixelRenderer::WorkerMain, this, (int)m_workers.size(), m_generation);
+        m_job = &job;
+        m_jobStripes = stripes;
+        m_pending = stripes - 1;
+        m_generation++;
+    }
+    m_wake.notify_all();
+    job(0);
+
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_done.wait(lock, [&] { return m_pending == 0; });
+    m_job = nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public SetFonts
+///  Sets the fonts of its own glyphs, throwing away those from the old ones
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void PixelRenderer::SetFonts(const wxFont &normal, const wxFont &underlined, const wxFont &bold,
+                             const wxFont &boldUnderlined)
+{
+    Render();
+    m_ownGlyphs.SetFonts(normal, underlined, bold, boldUnderlined);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public SetGlyphs
+///  Draws with glyphs shared with other renderers.  Resize sets their cell
+///  size as it does that of its own, so all that share them must be given
+///  the same one
+///
+///  @param  glyphs PixelGlyphs *  The glyphs, or nullptr for its own
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void PixelRenderer::SetGlyphs(PixelGlyphs *glyphs)
+{
+    Render();
+    m_glyphs = glyphs ? glyphs : &m_ownGlyphs;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public Resize
+///  Sets the size of the buffer in cells, and of the cells in pixels.  The
+///  buffer is cleared to black
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void PixelRenderer::Resize(int width, int height, int cellWidth, int cellHeight)
+{
+    // the buffer is cleared, so nothing queued matters
+    m_ops.clear();
+    m_opText.clear();
+    m_cellWidth = cellWidth;
+    m_cellHeight = cellHeight;
+    m_glyphs->SetCellSize(cellWidth, cellHeight);
+    m_width = width * cellWidth;
+    m_height = height * cellHeight;
+    m_pixels.assign((size_t)m_width * m_height, 0);
+    m_rowCells.assign(height, 0);
+    Damage(0, 0, width, height);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private Rasterise
+///  Draws the 256 characters of a style white on black and keeps how much
+///  of each pixel they cover
+///
+///  @param  style int  The style
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void PixelGlyphs::Rasterise(int style)
+{
+    std::vector<unsigned char> &masks = m_atlas[style];
+    int cw = m_cellWidth, ch = m_cellHeight, c, x, y;
+
+    masks.assign(256 * cw * ch, 0);
+    m_sets++;
+
+    if (style & PixelRenderer::STYLE_OVERSTRIKE)
+    {
+        // the plain glyphs, smeared a pixel to the right
+        const unsigned char *base = Glyph(style & ~PixelRenderer::STYLE_OVERSTRIKE, 0);
+        for (c = 0; c < 256 * ch; c++)
+        {
+            const unsigned char *from = base + c * cw;
+            unsigned char *to = masks.data() + c * cw;
+            to[0] = from[0];
+            for (x = 1; x < cw; x++)
+                to[x] = std::max(from[x], from[x - 1]);
+        }
+        return;
+    }
+
+    // the glyphs go in a 16 by 16 grid; 0 is left blank
+    wxBitmap bitmap(16 * cw, 16 * ch, 24);
+    wxMemoryDC dc;
+    dc.SelectObject(bitmap);
+    dc.SetBackground(*wxBLACK_BRUSH);
+    dc.Clear();
+    dc.SetFont(m_fonts[style & 3]);
+    dc.SetBackgroundMode(wxTRANSPARENT);
+    dc.SetTextForeground(*wxWHITE);
+    for (c = 1; c < 256; c++)
+        dc.DrawText(wxString(wxUniChar(m_charMap ? m_charMap[c] : c)), (c % 16) * cw, (c / 16) * ch);
+    dc.SelectObject(wxNullBitmap);
+
+    wxNativePixelData data(bitmap);
+    if (!data)
+        return;
+    wxNativePixelData::Iterator p(data);
+    for (y = 0; y < 16 * ch; y++)
+    {
+        wxNativePixelData::Iterator row = p;
+        for (x = 0; x < 16 * cw; x++, ++p)
+        {
+            c = (y / ch) * 16 + x / cw;
+            masks[(c * ch + y % ch) * cw + x % cw] = p.Green();
+        }
+        p = row;
+        p.OffsetY(data, 1);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public Glyph
+///  Finds the coverage mask of a character, rasterising its style if this
+///  is the first time it is used
+///
+///  @return const unsigned char * m_cellHeight rows of m_cellWidth values
+//////////////////////////////////////////////////////////////////////////////
+const unsigned char *PixelGlyphs::Glyph(int style, unsigned char c)
+{
+    if (m_atlas[style].empty())
+        Rasterise(style);
+    return m_atlas[style].data() + c * m_cellWidth * m_cellHeight;
+}
+
+void PixelRenderer::Damage(int x, int y, int w, int h)
+{
+    x *= m_cellWidth;
+    y *= m_cellHeight;
+    w *= m_cellWidth;
+    h *= m_cellHeight;
+    if (m_damageX1 >= m_damageX2)
+    {
+        m_damageX1 = x;
+        m_damageY1 = y;
+        m_damageX2 = x + w;
+        m_damageY2 = y + h;
+        return;
+    }
+    m_damageX1 = std::min(m_damageX1, x);
+    m_damageY1 = std::min(m_damageY1, y);
+    m_damageX2 = std::max(m_damageX2, x + w);
+    m_damageY2 = std::max(m_damageY2, y + h);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public DrawText
+///  Draws a run of characters
+///
+///  @param  x     int                   The x position in character cells
+///  @param  y     int                   The y position in character cells
+///  @param  text  const unsigned char * The characters
+///  @param  len   int                   How many there are
+///  @param  style int                   STYLE_ flags
+///  @param  fg    const wxColour &      The text colour
+///  @param  bg    const wxColour *      The background, or nullptr to draw
+///                                      over what is there
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void PixelRenderer::DrawText(int x, int y, const unsigned char *text, int len, int style,
+                             const wxColour &fg, const wxColour *bg)
+{
+    Op op;
+
+    if (x < 0 || y < 0 || (y + 1) * m_cellHeight > m_height)
+        return;
+    len = std::min(len, m_width / m_cellWidth - x);
+    if (len <= 0)
+        return;
+
+    // glyphs can only be rasterised on this thread
+    m_glyphs->Glyph(style, 0);
+    op.x = x;
+    op.y = y;
+    op.w = len;
+    op.h = 1;
+    op.style = style;
+    op.fg = PackColour(fg);
+    op.bg = bg ? PackColour(*bg) : 0;
+    op.opaque = bg != nullptr;
+    op.text = 0;
+    Queue(op, text);
+    m_stats.texts++;
+    m_stats.cells += len;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public FillRect
+///  Fills cells with a colour
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void PixelRenderer::FillRect(int x, int y, int w, int h, const wxColour &c)
+{
+    Op op;
+
+    op.x = std::max(0, x);
+    op.y = std::max(0, y);
+    op.w = std::min(m_width / m_cellWidth, x + w) - op.x;
+    op.h = std::min(m_height / m_cellHeight, y + h) - op.y;
+    if (op.w <= 0 || op.h <= 0)
+        return;
+    op.style = 0;
+    op.fg = op.bg = PackColour(c);
+    op.opaque = true;
+    op.text = -1;
+    Queue(op, nullptr);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private Queue
+///  Draws straight away with one thread, or keeps the drawing for Render
+///
+///  @param  op   const Op &            What to draw
+///  @param  text const unsigned char * Its characters, op.w of them
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void PixelRenderer::Queue(const Op &op, const unsigned char *text)
+{
+    int r;
+
+    Damage(op.x, op.y, op.w, op.h);
+    if (m_threads == 1)
+    {
+        if (text)
+        {
+            // Execute finds the characters in m_opText
+            m_opText.assign(text, text + op.w);
+        }
+        Execute(op, op.y, op.y + op.h);
+        return;
+    }
+
+    m_ops.push_back(op);
+    if (text)
+    {
+        m_ops.back().text = (int)m_opText.size();
+        m_opText.insert(m_opText.end(), text, text + op.w);
+    }
+    for (r = op.y; r < op.y + op.h; r++)
+        m_rowCells[r] += op.w;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private Execute
+///  Draws the rows of an Op that fall in a stripe
+///
+///  @param  op   const Op & What to draw
+///  @param  row1 int        The stripe's first row, in cells
+///  @param  row2 int        The row after its last
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void PixelRenderer::Execute(const Op &op, int row1, int row2)
+{
+    int cw = m_cellWidth, ch = m_cellHeight, i, r, py;
+
+    row1 = std::max(row1, op.y);
+    row2 = std::min(row2, op.y + op.h);
+    if (row1 >= row2)
+        return;
+
+    if (op.opaque)
+    {
+        for (py = row1 * ch; py < row2 * ch; py++)
+            std::fill(m_pixels.begin() + (size_t)py * m_width + op.x * cw,
+                      m_pixels.begin() + (size_t)py * m_width + (op.x + op.w) * cw, op.bg);
+    }
+    if (op.text < 0)
+        return;
+
+    const unsigned char *text = m_opText.data() + op.text;
+    for (i = 0; i < op.w; i++)
+    {
+        // nothing to draw for a blank, unless it is underlined
+        if ((text[i] == ' ' || !text[i]) && !(op.style & STYLE_UNDERLINE))
+            continue;
+        const unsigned char *mask = m_glyphs->Masks(op.style) + text[i] * cw * ch;
+        uint32_t *dst = m_pixels.data() + (size_t)op.y * ch * m_width + (op.x + i) * cw;
+        for (r = 0; r < ch; r++)
+            BlendOver(dst + r * m_width, mask + r * cw, cw, op.fg);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private Render
+///  Does the queued drawing, splitting the rows into a stripe per thread
+///  with about as many queued cells in each
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void PixelRenderer::Render()
+{
+    int rows = (int)m_rowCells.size(), total = 0, stripes, r, s, sum;
+
+    if (m_ops.empty())
+        return;
+
+    for (r = 0; r < rows; r++)
+        total += m_rowCells[r];
+    stripes = std::min(m_threads, rows);
+    if (total < PARALLEL_MIN_CELLS)
+        stripes = 1;
+
+    m_stripeRows.assign(1, 0);
+    for (r = 0, sum = 0, s = 1; r < rows && s < stripes; r++)
+    {
+        sum += m_rowCells[r];
+        if (sum * (long long)stripes >= (long long)total * s)
+        {
+            m_stripeRows.push_back(r + 1);
+            s++;
+        }
+    }
+    while ((int)m_stripeRows.size() <= stripes)
+        m_stripeRows.push_back(rows);
+    m_stripeRows.back() = rows;
+
+    std::function<void(int)> job = [this](int stripe) {
+        for (const Op &op : m_ops)
+            Execute(op, m_stripeRows[stripe], m_stripeRows[stripe + 1]);
+    };
+    if (stripes > 1)
+        RunStripes(stripes, job);
+    else
+        job(0);
+
+    m_stats.renders++;
+    m_stats.stripes += stripes;
+    m_ops.clear();
+    m_opText.clear();
+    std::fill(m_rowCells.begin(), m_rowCells.end(), 0);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public MoveRect
+///  Copies cells from sx, sy to dx, dy; the areas may overlap
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void PixelRenderer::MoveRect(int sx, int sy, int dx, int dy, int w, int h)
+{
+    int r, rows, from, to, bytes;
+
+    if (std::max(sx, dx) + w > m_width / m_cellWidth || std::max(sy, dy) + h > m_height / m_cellHeight ||
+        std::min(sx, dx) < 0 || std::min(sy, dy) < 0 || w <= 0 || h <= 0)
+        return;
+    // the move has to see everything drawn before it
+    Render();
+
+    rows = h * m_cellHeight;
+    bytes = w * m_cellWidth * sizeof(uint32_t);
+    from = sy * m_cellHeight * m_width + sx * m_cellWidth;
+    to = dy * m_cellHeight * m_width + dx * m_cellWidth;
+    // go bottom up when moving down, so rows aren't overwritten before they are copied
+    if (to > from)
+        for (r = rows - 1; r >= 0; r--)
+            memmove(&m_pixels[to + r * m_width], &m_pixels[from + r * m_width], bytes);
+    else
+        for (r = 0; r < rows; r++)
+            memmove(&m_pixels[to + r * m_width], &m_pixels[from + r * m_width], bytes);
+    Damage(dx, dy, w, h);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public Flush
+///  Copies what has changed since the last Flush into a bitmap, which must
+///  not be selected into a DC
+///
+///  @param  bitmap wxBitmap & The bitmap, at least as big as the buffer
+///
+///  @return bool false if the bitmap's pixels couldn't be reached
+//////////////////////////////////////////////////////////////////////////////
+bool PixelRenderer::Flush(wxBitmap &bitmap)
+{
+    int x1, y1, x2, y2, stripes;
+
+    Render();
+    if (!HasDamage())
+        return true;
+    x1 = std::max(0, m_damageX1);
+    y1 = std::max(0, m_damageY1);
+    x2 = std::min(std::min(m_damageX2, m_width), bitmap.GetWidth());
+    y2 = std::min(std::min(m_damageY2, m_height), bitmap.GetHeight());
+    m_damageX1 = m_damageX2 = 0;
+    if (x1 >= x2 || y1 >= y2)
+        return true;
+
+    wxNativePixelData data(bitmap, wxPoint(x1, y1), wxSize(x2 - x1, y2 - y1));
+    if (!data)
+        return false;
+    // the stripes are disjoint rows of the bitmap, so they can be copied at once
+    stripes = (x2 - x1) * (y2 - y1) < PARALLEL_MIN_PIXELS ? 1 : std::min(m_threads, y2 - y1);
+    std::function<void(int)> job = [&](int stripe) {
+        int x, y, from = y1 + (y2 - y1) * stripe / stripes, to = y1 + (y2 - y1) * (stripe + 1) / stripes;
+        wxNativePixelData::Iterator p(data);
+
+        p.OffsetY(data, from - y1);
+        for (y = from; y < to; y++)
+        {
+            wxNativePixelData::Iterator row = p;
+            const uint32_t *src = m_pixels.data() + (size_t)y * m_width;
+            for (x = x1; x < x2; x++, ++p)
+            {
+                p.Red() = src[x] >> 16;
+                p.Green() = src[x] >> 8;
+                p.Blue() = src[x];
+            }
+            p = row;
+            p.OffsetY(data, 1);
+        }
+    };
+    if (stripes > 1)
+        RunStripes(stripes, job);
+    else
+        job(0);
+    m_stats.flushes++;
+    m_stats.flushedPixels += (unsigned long long)(x2 - x1) * (y2 - y1);
+    return true;
+}
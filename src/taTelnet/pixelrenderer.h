@@ -0,0 +1,161 @@
+/*
+    taTelnet - A cross-platform telnet program.
+
+License: wxWindows License Version 3.1 (See the file license3.txt)
+
+*/
+
+
+#ifndef INCLUDE_PIXELRENDERER
+#define INCLUDE_PIXELRENDERER
+
+#include <wx/bitmap.h>
+#include <wx/colour.h>
+#include <wx/font.h>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////
+///  class PixelGlyphs
+///  Coverage masks of the 256 characters of each PixelRenderer style, a
+///  cell each, rasterised the first time the style is drawn.  Any number of
+///  renderers drawing with the same fonts and cell size can share one
+//////////////////////////////////////////////////////////////////////////////
+class PixelGlyphs
+{
+public:
+    PixelGlyphs();
+
+    void SetFonts(const wxFont &normal, const wxFont &underlined, const wxFont &bold,
+                  const wxFont &boldUnderlined);
+    void SetCharMap(const unsigned char *map);
+    void SetCellSize(int cellWidth, int cellHeight);
+
+    const unsigned char *Glyph(int style, unsigned char c);
+    // the masks of a style already rasterised by Glyph
+    const unsigned char *Masks(int style) { return m_atlas[style].data(); }
+
+    unsigned long GetSets() { return m_sets; }
+    size_t GetMemory();
+
+private:
+    void Rasterise(int style);
+    void Clear();
+
+    int m_cellWidth, m_cellHeight;
+    wxFont m_fonts[4];
+    const unsigned char *m_charMap; // glyph each character is drawn as, or nullptr
+
+    // empty until the style is first drawn
+    std::vector<unsigned char> m_atlas[8];
+
+    unsigned long m_sets; // styles rasterised
+};
+
+//////////////////////////////////////////////////////////////////////////////
+///  class PixelRenderer
+///  Draws terminal cells into a pixel buffer of its own, blending glyph
+///  coverage masks from a PixelGlyphs, and copies the changed part of
+///  the buffer into a bitmap when asked.  Positions and sizes are in cells.
+///  With more than one thread, drawing is queued and done by row stripes
+///  on a pool of workers when the buffer is next moved or flushed.
+//////////////////////////////////////////////////////////////////////////////
+class PixelRenderer
+{
+public:
+    // font styles, as passed to DrawText
+    enum
+    {
+        STYLE_UNDERLINE = 1,
+        STYLE_BOLD = 2,      // the bold font
+        STYLE_OVERSTRIKE = 4 // drawn a second time one pixel to the right
+    };
+
+    struct Stats
+    {
+        unsigned long glyphSets;   // fonts rasterised into the glyphs drawn with
+        unsigned long texts;       // DrawText calls
+        unsigned long cells;       // cells blended
+        unsigned long flushes;     // copies to a bitmap
+        unsigned long long flushedPixels;
+        unsigned long renders;     // queues drawn by the workers
+        unsigned long stripes;     // stripes they were split into
+    };
+
+    PixelRenderer();
+    ~PixelRenderer();
+
+    // glyphs of its own, used until SetGlyphs is given some to share
+    void SetFonts(const wxFont &normal, const wxFont &underlined, const wxFont &bold,
+                  const wxFont &boldUnderlined);
+    void SetCharMap(const unsigned char *map) { m_ownGlyphs.SetCharMap(map); }
+    // glyphs shared with other renderers, which must outlive their use
+    // here; nullptr goes back to its own
+    void SetGlyphs(PixelGlyphs *glyphs);
+    void Resize(int width, int height, int cellWidth, int cellHeight);
+
+    void DrawText(int x, int y, const unsigned char *text, int len, int style, const wxColour &fg,
+                  const wxColour *bg);
+    void FillRect(int x, int y, int w, int h, const wxColour &c);
+    void MoveRect(int sx, int sy, int dx, int dy, int w, int h);
+    bool Flush(wxBitmap &bitmap);
+    bool HasDamage() { return m_damageX1 < m_damageX2; }
+
+    void SetThreads(int threads);
+    int GetThreads() { return m_threads; }
+
+    Stats GetStats();
+    size_t GetMemory(); // the buffer, queue and glyphs of its own
+
+private:
+    // a queued DrawText or FillRect, clipped to the buffer
+    struct Op
+    {
+        int x, y, w, h;
+        int style;
+        uint32_t fg, bg;
+        bool opaque; // fill behind the text, or the whole rectangle if there is no text
+        int text;    // offset into m_opText, or -1 for FillRect
+    };
+
+    void Damage(int x, int y, int w, int h);
+    void Queue(const Op &op, const unsigned char *text);
+    void Execute(const Op &op, int row1, int row2);
+    void Render();
+    void RunStripes(int stripes, const std::function<void(int)> &job);
+    void WorkerMain(int id, unsigned generation);
+
+    int m_width, m_height;         // in pixels
+    int m_cellWidth, m_cellHeight;
+    std::vector<uint32_t> m_pixels; // 0x00RRGGBB, m_width to a row
+
+    PixelGlyphs m_ownGlyphs;
+    PixelGlyphs *m_glyphs; // m_ownGlyphs, or shared ones
+
+    // the part of m_pixels changed since the last Flush
+    int m_damageX1, m_damageY1, m_damageX2, m_damageY2;
+
+    // drawing not yet done, in the order it was asked for
+    std::vector<Op> m_ops;
+    std::vector<unsigned char> m_opText;
+    std::vector<int> m_rowCells; // cells queued on each row, to balance the stripes
+    std::vector<int> m_stripeRows;
+
+    // the worker pool; worker i draws stripe i + 1 and the caller stripe 0
+    int m_threads;
+    std::vector<std::thread> m_workers;
+    std::mutex m_lock;
+    std::condition_variable m_wake, m_done;
+    const std::function<void(int)> *m_job;
+    int m_jobStripes, m_pending;
+    unsigned m_generation;
+    bool m_quit;
+
+    Stats m_stats;
+};
+
+#endif /* INCLUDE_PIXELRENDERER */
@@ -0,0 +1,217 @@
+/*
+    taTelnet - A cross-platform telnet program.
+
+License: wxWindows License Version 3.1 (See the file license3.txt)
+
+*/
+
+// For compilers that support precompilation, includes "wx/wx.h".
+#include "wx/wxprec.h"
+
+#ifdef __BORLANDC__
+#pragma hdrstop
+#endif
+
+#include <wx/dcclient.h>
+
+#include <algorithm>
+
+#include "termresources.h"
+
+// the scratch bitmap grows by half again, as the terminals' bitmaps do
+#define SCRATCH_GROWTH(n) ((n) + (n) / 2)
+
+std::vector<TermResources *> TermResources::s_registry;
+wxMemoryDC *TermResources::s_scratchDC = nullptr;
+wxBitmap *TermResources::s_scratchBitmap = nullptr;
+
+TermResources::TermResources(const wxFont &font, const wxColour vtColors[16],
+                             const wxColour pcColors[16], const unsigned char *charMap)
+{
+    int i;
+
+    m_fontDesc = font.GetNativeFontInfoDesc();
+    m_fonts[0] = font;
+    m_fonts[PixelRenderer::STYLE_UNDERLINE] = font;
+    m_fonts[PixelRenderer::STYLE_UNDERLINE].SetUnderlined(TRUE);
+    m_fonts[PixelRenderer::STYLE_BOLD] = font;
+    m_fonts[PixelRenderer::STYLE_BOLD].SetWeight(wxBOLD);
+    m_fonts[PixelRenderer::STYLE_BOLD | PixelRenderer::STYLE_UNDERLINE] = m_fonts[PixelRenderer::STYLE_BOLD];
+    m_fonts[PixelRenderer::STYLE_BOLD | PixelRenderer::STYLE_UNDERLINE].SetUnderlined(TRUE);
+
+    for (i = 0; i < 16; i++)
+    {
+        m_vtColors[i] = vtColors[i];
+        m_vtPens[i] = wxPen(m_vtColors[i], 1, wxSOLID);
+        m_vtBrushes[i] = wxBrush(m_vtColors[i], wxSOLID);
+        m_pcColors[i] = pcColors[i];
+        m_pcPens[i] = wxPen(m_pcColors[i], 1, wxSOLID);
+        m_pcBrushes[i] = wxBrush(m_pcColors[i], wxSOLID);
+    }
+
+    m_charMap = charMap;
+    for (i = 0; i < 2; i++)
+    {
+        m_cellWidth[i] = m_cellHeight[i] = 0;
+        m_glyphs[i].SetFonts(m_fonts[0], m_fonts[1], m_fonts[2], m_fonts[3]);
+        m_glyphs[i].SetCharMap(charMap);
+    }
+    m_users = 0;
+}
+
+bool TermResources::Matches(const wxString &fontDesc, const wxColour vtColors[16],
+                            const wxColour pcColors[16], const unsigned char *charMap)
+{
+    int i;
+
+    if (charMap != m_charMap || fontDesc != m_fontDesc)
+        return false;
+    for (i = 0; i < 16; i++)
+        if (vtColors[i] != m_vtColors[i] || pcColors[i] != m_pcColors[i])
+            return false;
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public static Acquire
+///  Finds the resources for a font and palettes, building them if no
+///  terminal has them yet.  Each call is matched by a Release
+///
+///  @param  font     const wxFont &   The normal font
+///  @param  vtColors const wxColour[] The VT100 colours
+///  @param  pcColors const wxColour[] The PC colours
+///  @param  charMap  const unsigned char * The glyph each character is drawn as, or nullptr
+///
+///  @return TermResources * The resources
+//////////////////////////////////////////////////////////////////////////////
+TermResources *TermResources::Acquire(const wxFont &font, const wxColour vtColors[16],
+                                      const wxColour pcColors[16], const unsigned char *charMap)
+{
+    wxString fontDesc = font.GetNativeFontInfoDesc();
+    TermResources *resources = nullptr;
+
+    for (TermResources *r : s_registry)
+        if (r->Matches(fontDesc, vtColors, pcColors, charMap))
+        {
+            resources = r;
+            break;
+        }
+    if (!resources)
+    {
+        resources = new TermResources(font, vtColors, pcColors, charMap);
+        s_registry.push_back(resources);
+    }
+    resources->m_users++;
+    return resources;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public static Release
+///  Gives up resources from Acquire, deleting them once no terminal uses
+///  them, and the scratch bitmap once there are none left
+///
+///  @param  resources TermResources *  The resources, or nullptr
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void TermResources::Release(TermResources *resources)
+{
+    if (!resources || --resources->m_users > 0)
+        return;
+    s_registry.erase(std::find(s_registry.begin(), s_registry.end(), resources));
+    delete resources;
+
+    if (s_registry.empty() && s_scratchDC)
+    {
+        s_scratchDC->SelectObject(wxNullBitmap);
+        delete s_scratchBitmap;
+        delete s_scratchDC;
+        s_scratchBitmap = nullptr;
+        s_scratchDC = nullptr;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public Measure
+///  Finds the size of a character cell, measuring it the first time it is
+///  asked for, and sizes the glyphs to match
+///
+///  @param  window wxWindow * A window to measure with
+///  @param  bold   bool       Measure in the bold font, for BS_FONT
+///  @param  width  int &      Set to the cell width
+///  @param  height int &      Set to the cell height
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void TermResources::Measure(wxWindow *window, bool bold, int &width, int &height)
+{
+    if (!m_cellWidth[bold])
+    {
+        wxClientDC dc(window);
+
+        dc.SetFont(m_fonts[bold ? PixelRenderer::STYLE_BOLD : 0]);
+        dc.GetTextExtent("M", &m_cellWidth[bold], &m_cellHeight[bold]);
+        m_glyphs[bold].SetCellSize(m_cellWidth[bold], m_cellHeight[bold]);
+    }
+    width = m_cellWidth[bold];
+    height = m_cellHeight[bold];
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public static Scratch
+///  Finds a DC with a bitmap selected at least the given size, for copying
+///  through.  What is in it is only kept until the next call
+///
+///  @param  width  int  The width needed, in pixels
+///  @param  height int  The height needed, in pixels
+///
+///  @return wxMemoryDC & The DC
+//////////////////////////////////////////////////////////////////////////////
+wxMemoryDC &TermResources::Scratch(int width, int height)
+{
+    int bw, bh;
+
+    if (!s_scratchDC)
+        s_scratchDC = new wxMemoryDC;
+    bw = s_scratchBitmap ? s_scratchBitmap->GetWidth() : 0;
+    bh = s_scratchBitmap ? s_scratchBitmap->GetHeight() : 0;
+    if (width > bw || height > bh)
+    {
+        if (width > bw)
+            bw = std::max(width, SCRATCH_GROWTH(bw));
+        if (height > bh)
+            bh = std::max(height, SCRATCH_GROWTH(bh));
+        s_scratchDC->SelectObject(wxNullBitmap);
+        delete s_scratchBitmap;
+        s_scratchBitmap = new wxBitmap(bw, bh);
+        s_scratchDC->SelectObject(*s_scratchBitmap);
+    }
+    return *s_scratchDC;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public GetMemory
+///  Estimates the memory the resources hold, the glyphs being most of it.
+///  The fonts, pens and brushes are counted as their handles, as what the
+///  system keeps for them can't be seen
+///
+///  @return size_t Bytes
+//////////////////////////////////////////////////////////////////////////////
+size_t TermResources::GetMemory()
+{
+    return sizeof(*this) + m_glyphs[0].GetMemory() + m_glyphs[1].GetMemory();
+}
+
+int TermResources::GetTotalUsers()
+{
+    int users = 0;
+
+    for (TermResources *r : s_registry)
+        users += r->m_users;
+    return users;
+}
+
+size_t TermResources::GetScratchMemory()
+{
+    return s_scratchBitmap ? (size_t)s_scratchBitmap->GetWidth() * s_scratchBitmap->GetHeight() * 4 : 0;
+}
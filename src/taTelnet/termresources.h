@@ -0,0 +1,82 @@
+/*
+    taTelnet - A cross-platform telnet program.
+
+License: wxWindows License Version 3.1 (See the file license3.txt)
+
+*/
+
+
+#ifndef INCLUDE_TERMRESOURCES
+#define INCLUDE_TERMRESOURCES
+
+#include <wx/brush.h>
+#include <wx/colour.h>
+#include <wx/dcmemory.h>
+#include <wx/font.h>
+#include <wx/pen.h>
+#include <wx/string.h>
+#include <wx/window.h>
+#include <vector>
+#include "pixelrenderer.h"
+
+//////////////////////////////////////////////////////////////////////////////
+///  class TermResources
+///  What terminals with the same font, palettes and character map draw
+///  with: the fonts for each style, the colours with a pen and brush each,
+///  the cell size and the glyphs of the PixelRenderer.  They are built once
+///  and shared by all such terminals, which Acquire and Release them.
+///  Terminals also share a scratch bitmap, as they only use it while
+///  copying one area of their own to another
+//////////////////////////////////////////////////////////////////////////////
+class TermResources
+{
+public:
+    static TermResources *Acquire(const wxFont &font, const wxColour vtColors[16],
+                                  const wxColour pcColors[16], const unsigned char *charMap);
+    static void Release(TermResources *resources);
+
+    const wxColour *Colors(bool pc) { return pc ? m_pcColors : m_vtColors; }
+    const wxPen *Pens(bool pc) { return pc ? m_pcPens : m_vtPens; }
+    const wxBrush *Brushes(bool pc) { return pc ? m_pcBrushes : m_vtBrushes; }
+    // indexed by PixelRenderer::STYLE_UNDERLINE and STYLE_BOLD
+    const wxFont &Font(int style) { return m_fonts[style & 3]; }
+    const unsigned char *GetCharMap() { return m_charMap; }
+
+    void Measure(wxWindow *window, bool bold, int &width, int &height);
+    // the glyphs for cells measured in the bold font or the normal one
+    PixelGlyphs *Glyphs(bool bold) { return &m_glyphs[bold]; }
+
+    static wxMemoryDC &Scratch(int width, int height);
+
+    int GetUsers() { return m_users; }
+    size_t GetMemory();
+    static int GetCount() { return (int)s_registry.size(); }
+    static int GetTotalUsers();
+    static size_t GetScratchMemory();
+
+private:
+    TermResources(const wxFont &font, const wxColour vtColors[16], const wxColour pcColors[16],
+                  const unsigned char *charMap);
+
+    bool Matches(const wxString &fontDesc, const wxColour vtColors[16], const wxColour pcColors[16],
+                 const unsigned char *charMap);
+
+    wxString m_fontDesc; // the native description of the normal font, its key
+    wxFont m_fonts[4];
+    wxColour m_vtColors[16], m_pcColors[16];
+    wxPen m_vtPens[16], m_pcPens[16];
+    wxBrush m_vtBrushes[16], m_pcBrushes[16];
+    const unsigned char *m_charMap;
+
+    // the cell size, measured in the normal font or the bold one when first asked
+    int m_cellWidth[2], m_cellHeight[2];
+    PixelGlyphs m_glyphs[2];
+
+    int m_users;
+
+    static std::vector<TermResources *> s_registry;
+    static wxMemoryDC *s_scratchDC;
+    static wxBitmap *s_scratchBitmap;
+};
+
+#endif /* INCLUDE_TERMRESOURCES */
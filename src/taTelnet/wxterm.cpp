@@ -19,6 +19,7 @@ License: wxWindows License Version 3.1 (See the file license3.txt)
 #pragma hdrstop
 #endif
 
+#include <wx/app.h>
 #include <wx/bitmap.h>
 #include <wx/brush.h>
 #include <wx/clipbrd.h>
@@ -29,12 +30,17 @@ License: wxWindows License Version 3.1 (See the file license3.txt)
 #include <wx/log.h>
 #include <wx/menu.h>
 #include <wx/pen.h>
+#include <wx/rawbmp.h>
 #include <wx/settings.h>
+#include <wx/stopwatch.h>
 #include <wx/timer.h>
+#include <wx/toplevel.h>
 #include <wx/utils.h>
 
 #include <algorithm>
 #include <ctype.h>
+#include <string>
+#include <thread>
 
 #include "../GTerm/gterm.hpp"
 #include "wxterm.h"
@@ -46,8 +52,14 @@ License: wxWindows License Version 3.1 (See the file license3.txt)
 #define TIMER_TIMEOUT 100
 #define CURSOR_BLINK_DEFAULT_TIMEOUT 500
 #define CURSOR_BLINK_MAX_TIMEOUT 2000
+#define PARSE_BUDGET_DEFAULT_USECS 8000
+#define COPY_THREAD_THRESHOLD (1 << 20) // bytes of selection extracted off the GUI thread
 #define ID_MENU_COPY 1000
 #define ID_MENU_PASTE 1001
+#define ID_RESIZE_TIMER 1002
+#define RESIZE_DELAY_MSECS 40 // window size changes are applied at most this often
+#define BITMAP_GROWTH(n) ((n) + (n) / 2)
+#define PIXEL_THREADS_DEFAULT_MAX 4 // the PixelRenderer uses up to this many cores
 
 
 BEGIN_EVENT_TABLE(wxTerm, wxScrolledWindow)
@@ -59,7 +71,10 @@ EVT_CHAR(wxTerm::OnChar)
 EVT_LEFT_DOWN(wxTerm::OnLeftDown)
 EVT_LEFT_UP(wxTerm::OnLeftUp)
 EVT_MOTION(wxTerm::OnMouseMove)
+EVT_MOUSEWHEEL(wxTerm::OnMouseWheel)
+EVT_TIMER(ID_RESIZE_TIMER, wxTerm::OnResizeTimer)
 EVT_TIMER(-1, wxTerm::OnTimer)
+EVT_IDLE(wxTerm::OnIdle)
 EVT_SCROLLWIN_THUMBTRACK(wxTerm::OnScroll)
 EVT_SCROLLWIN_THUMBRELEASE(wxTerm::OnScroll)
 EVT_SCROLLWIN_LINEUP(wxTerm::OnScroll)
@@ -72,17 +87,112 @@ EVT_MENU(ID_MENU_COPY, wxTerm::OnMenuCopy)
 EVT_MENU(ID_MENU_PASTE, wxTerm::OnMenuPaste)
 END_EVENT_TABLE()
 
+// every wakeup of every wxTerm's timers, for GetWakeupsPerSecond
+static unsigned long long s_wakeups = 0;
+
+//////////////////////////////////////////////////////////////////////////////
+///  class wxTermBlinkClock
+///  One timer blinking the cursors of all the terminals that have a
+///  blinking cursor showing, so they blink together and the rest cost no
+///  wakeups at all.  It exists only while some terminal is using it
+//////////////////////////////////////////////////////////////////////////////
+class wxTermBlinkClock : public wxTimer
+{
+public:
+    static void Add(wxTerm *term);
+    static void Remove(wxTerm *term);
+    static bool CursorOn(wxLongLong now, int rate);
+
+    virtual void Notify();
+
+private:
+    void Restart();
+
+    std::vector<wxTerm *> m_terms;
+    int m_rate; // the fastest of their blink rates, which the clock ticks at
+    wxLongLong m_epoch; // every cursor turns on at the same time after this
+};
+
+static wxTermBlinkClock *s_blinkClock = nullptr;
+
+void wxTermBlinkClock::Add(wxTerm *term)
+{
+    if (!s_blinkClock)
+    {
+        s_blinkClock = new wxTermBlinkClock();
+        s_blinkClock->m_rate = 0;
+        s_blinkClock->m_epoch = wxGetUTCTimeMillis();
+    }
+    if (std::find(s_blinkClock->m_terms.begin(), s_blinkClock->m_terms.end(), term) ==
+        s_blinkClock->m_terms.end())
+        s_blinkClock->m_terms.push_back(term);
+    s_blinkClock->Restart();
+}
+
+void wxTermBlinkClock::Remove(wxTerm *term)
+{
+    if (!s_blinkClock)
+        return;
+    std::vector<wxTerm *> &terms = s_blinkClock->m_terms;
+    terms.erase(std::remove(terms.begin(), terms.end(), term), terms.end());
+    if (terms.empty())
+    {
+        delete s_blinkClock;
+        s_blinkClock = nullptr;
+        return;
+    }
+    s_blinkClock->Restart();
+}
+
+// Ticks at the fastest rate in use, if it isn't already
+void wxTermBlinkClock::Restart()
+{
+    int rate = m_terms.front()->m_curBlinkRate;
+
+    for (wxTerm *term : m_terms)
+        rate = std::min(rate, term->m_curBlinkRate);
+    if (rate != m_rate || !IsRunning())
+    {
+        m_rate = rate;
+        Start(rate);
+    }
+}
+
+// Whether a cursor blinking at rate is on; the clock is read half way
+// through each phase, so its ticks needn't land exactly on the changes
+bool wxTermBlinkClock::CursorOn(wxLongLong now, int rate)
+{
+    long long t = (now - s_blinkClock->m_epoch).GetValue();
+
+    return (t + rate / 2) / rate % 2 == 0;
+}
+
+void wxTermBlinkClock::Notify()
+{
+    wxLongLong now = wxGetUTCTimeMillis();
+
+    s_wakeups++;
+    // a terminal may leave the clock as it blinks, so go through a copy
+    std::vector<wxTerm *> terms = m_terms;
+    for (wxTerm *term : terms)
+        term->Blink(now);
+}
+
 wxTerm::wxTerm(wxWindow *parent, wxWindowID id, const wxPoint &pos, int width, int height,
                const wxString &name) :
     // wxScrolled<wxWindow>
     wxScrolledWindow(parent, id, pos, wxSize(-1, -1), wxWANTS_CHARS, name), GTerm(width, height)
 {
-    int i;
+    wxColour vtColors[16], pcColors[16];
 
     m_inUpdateSize = false;
     m_init = 1;
     m_bitmap = nullptr;
+    m_thumbScale = 1;
+    m_resources = nullptr;
     m_curDC = nullptr;
+    m_metricsValid = false;
+    InvalidateDCState();
     m_printerFN = nullptr;
     m_printerName = nullptr;
 
@@ -90,45 +200,48 @@ wxTerm::wxTerm(wxWindow *parent, wxWindowID id, const wxPoint &pos, int width, i
     m_linesDisplayed = height;
 
     m_selecting = FALSE;
-    m_selx1 = m_sely1 = m_selx2 = m_sely2 = 0;
-    m_marking = FALSE;
     m_autoscroll = TRUE;
-    m_curX = 0;
-    m_curY = 0;
+    m_curX = -1;
+    m_curY = -1;
+    m_curState = 1;
     m_curBlinkRate = CURSOR_BLINK_DEFAULT_TIMEOUT;
+    m_hasFocus = false;
     m_timer.SetOwner(this);
-    m_timer.Start(TIMER_TIMEOUT);
+    m_resizeTimer.SetOwner(this, ID_RESIZE_TIMER);
     m_blinkTimer = wxGetUTCTimeMillis();
 
+    m_pendingPos = 0;
+    m_parseBudgetUsecs = PARSE_BUDGET_DEFAULT_USECS;
+    m_parseBudgetBytes = 0;
+    m_discardOnInterrupt = false;
+    m_copyCancel = false;
+    m_keyTimestamp = 0;
+    m_keyClockBase = 0;
+    m_keyClockKnown = false;
+    ResetStats();
+
     m_boldStyle = BS_COLOR;
 
-    GetDefVTColors(m_vt_colors);
-    GetDefPCColors(m_pc_colors);
+    GetDefVTColors(vtColors);
+    GetDefPCColors(pcColors);
 
-    m_colors = m_vt_colors;
+    wxFont monospacedFont(10, wxMODERN, wxNORMAL, wxNORMAL, false, "Courier New");
+    AcquireResources(monospacedFont, vtColors, pcColors);
 
     SetBackgroundColour(m_colors[0]);
 
-    for (i = 0; i < 16; i++)
-        m_vt_colorPens[i] = wxPen(m_vt_colors[i], 1, wxSOLID);
-
-    for (i = 0; i < 16; i++)
-        m_pc_colorPens[i] = wxPen(m_pc_colors[i], 1, wxSOLID);
-
-    m_colorPens = m_vt_colorPens;
+    m_pendingClear.color = -1;
+    m_damageTop = 0;
+    m_damageBottom = -1;
+    m_drawString.reserve(MAXWIDTH);
+    m_usePixels = false;
+    // the cursor is drawn over the bitmap when it is shown, never into it
+    SetCursorOverlay(true);
+    m_pixelRenderer.SetThreads(std::min<int>(std::thread::hardware_concurrency(), PIXEL_THREADS_DEFAULT_MAX));
 
     m_width = width;
     m_height = height;
 
-    m_normalFont = GetFont();
-    m_underlinedFont = GetFont();
-    m_underlinedFont.SetUnderlined(TRUE);
-    m_boldFont = GetFont();
-    m_boldFont.SetWeight(wxBOLD);
-    m_boldUnderlinedFont = m_boldFont;
-    m_boldUnderlinedFont.SetUnderlined(TRUE);
-
-    wxFont monospacedFont(10, wxMODERN, wxNORMAL, wxNORMAL, false, "Courier New");
     SetFont(monospacedFont);
 
     SetCursor(wxCursor(wxCURSOR_IBEAM));
@@ -145,11 +258,15 @@ wxTerm::wxTerm(wxWindow *parent, wxWindowID id, const wxPoint &pos, int width, i
 
 wxTerm::~wxTerm()
 {
+    StopCopy();
+    wxTermBlinkClock::Remove(this);
     if (m_bitmap)
     {
         m_memDC.SelectObject(wxNullBitmap);
         delete m_bitmap;
     }
+    m_pixelRenderer.SetGlyphs(nullptr);
+    TermResources::Release(m_resources);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -169,7 +286,17 @@ void wxTerm::SetBoldStyle(wxTerm::BOLDSTYLE boldStyle)
     if (boldStyle == BS_DEFAULT)
         boldStyle = BS_COLOR;
 
+    // with BS_FONT the cells are measured in the bold font
+    if ((boldStyle == BS_FONT) != (m_boldStyle == BS_FONT))
+    {
+        m_boldStyle = boldStyle;
+        m_metricsValid = false;
+        ResizeTerminal(m_width, m_height);
+    }
+    else
+        ExposeAll();
     m_boldStyle = boldStyle;
+    m_thumbRows.clear();
     //  GetDefVTColors(colors, m_boldStyle);
     //  SetVTColors(colors);
     Refresh();
@@ -190,13 +317,7 @@ bool wxTerm::SetFont(const wxFont &font)
     m_init = 1;
 
     wxWindow::SetFont(font);
-    m_normalFont = font;
-    m_underlinedFont = font;
-    m_underlinedFont.SetUnderlined(TRUE);
-    m_boldFont = GetFont();
-    m_boldFont.SetWeight(wxBOLD);
-    m_boldUnderlinedFont = m_boldFont;
-    m_boldUnderlinedFont.SetUnderlined(TRUE);
+    AcquireResources(font, m_resources->Colors(false), m_resources->Colors(true));
     m_init = 0;
 
     ResizeTerminal(m_width, m_height);
@@ -288,7 +409,7 @@ void wxTerm::GetVTColors(wxColour colors[16])
     int i;
 
     for (i = 0; i < 16; i++)
-        colors[i] = m_vt_colors[i];
+        colors[i] = m_resources->Colors(false)[i];
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -303,19 +424,16 @@ void wxTerm::GetVTColors(wxColour colors[16])
 //////////////////////////////////////////////////////////////////////////////
 void wxTerm::SetVTColors(wxColour colors[16])
 {
-    int i;
-
     m_init = 1;
-    for (i = 0; i < 16; i++)
-        m_vt_colors[i] = colors[i];
+    FlushClear();
+    AcquireResources(m_resources->Font(0), colors, m_resources->Colors(true));
 
     if (!(GetMode() & PC))
-        SetBackgroundColour(m_vt_colors[0]);
-
-    for (i = 0; i < 16; i++)
-        m_vt_colorPens[i] = wxPen(m_vt_colors[i], 1, wxSOLID);
+        SetBackgroundColour(m_colors[0]);
     m_init = 0;
 
+    // the bitmap holds the old colours
+    ExposeAll();
     Refresh();
 }
 
@@ -400,7 +518,7 @@ void wxTerm::GetPCColors(wxColour colors[16])
     int i;
 
     for (i = 0; i < 16; i++)
-        colors[i] = m_pc_colors[i];
+        colors[i] = m_resources->Colors(true)[i];
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -415,19 +533,16 @@ void wxTerm::GetPCColors(wxColour colors[16])
 //////////////////////////////////////////////////////////////////////////////
 void wxTerm::SetPCColors(wxColour colors[16])
 {
-    int i;
-
     m_init = 1;
-    for (i = 0; i < 16; i++)
-        m_pc_colors[i] = colors[i];
+    FlushClear();
+    AcquireResources(m_resources->Font(0), m_resources->Colors(false), colors);
 
     if (GetMode() & PC)
-        SetBackgroundColour(m_pc_colors[0]);
-
-    for (i = 0; i < 16; i++)
-        m_pc_colorPens[i] = wxPen(m_pc_colors[i], 1, wxSOLID);
+        SetBackgroundColour(m_colors[0]);
     m_init = 0;
 
+    // the bitmap holds the old colours
+    ExposeAll();
     Refresh();
 }
 
@@ -447,15 +562,9 @@ void wxTerm::SetCursorBlinkRate(int rate)
         return;
 
     m_init = 1;
-    if (rate != m_curBlinkRate)
-    {
-        m_curBlinkRate = rate;
-        if (!m_curBlinkRate)
-            m_timer.Stop();
-        else
-            m_timer.Start(m_curBlinkRate);
-    }
+    m_curBlinkRate = rate;
     m_init = 0;
+    UpdateTimers();
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -470,6 +579,8 @@ void wxTerm::SetCursorBlinkRate(int rate)
 //////////////////////////////////////////////////////////////////////////////
 void wxTerm::OnChar(wxKeyEvent &event)
 {
+    m_keyTimestamp = event.GetTimestamp();
+
     if (!(GetMode() & PC) && event.AltDown())
         event.Skip();
     else
@@ -525,7 +636,7 @@ void wxTerm::OnChar(wxKeyEvent &event)
                 buf[len] = 10;
                 len++;
             }
-            ProcessOutput(len, buf);
+            SendKey(len, (char *)buf);
             if ((GetMode() & LOCALECHO) && !(GetMode() & PC))
                 ProcessInput(len, buf);
         }
@@ -542,7 +653,7 @@ void wxTerm::OnChar(wxKeyEvent &event)
                 len = 1;
                 buf[0] = keyCode;
             }
-            ProcessOutput(len, buf);
+            SendKey(len, (char *)buf);
             if ((GetMode() & LOCALECHO) && !(GetMode() & PC))
                 ProcessInput(len, buf);
             event.Skip();
@@ -589,47 +700,48 @@ void wxTerm::OnKeyDown(wxKeyEvent &event)
 //////////////////////////////////////////////////////////////////////////////
 void wxTerm::OnPaint(wxPaintEvent &WXUNUSED(event))
 {
-    // depending on your system you may need to look at double-buffered dcs
-    // wxPaintDC || wxBufferedPaintDC || wxAutoBufferedPaintDC
-    wxBufferedPaintDC dc(this);
+    wxPaintDC dc(this);
     DoPrepareDC(dc);
-    m_curDC = &dc;
 
+    if (!m_bitmap)
+        return;
+
+    // being painted, it is shown again
+    if (IsParseOnly())
+        UpdateParseOnly();
+
+    // changes that came without a Dirty, as after ExposeAll
+    UpdateBitmap();
+
+    // then copy the damaged rectangles from it, filling whatever lies
+    // outside the character cells with the background colour; the bitmap
+    // may be bigger than the cells
+    int bw = std::min(m_bitmap->GetWidth(), m_width * m_charWidth);
+    int bh = std::min(m_bitmap->GetHeight(), m_height * m_charHeight);
     int vX, vY, vW, vH;
+
+    dc.SetPen(m_colorPens[0]);
+    dc.SetBrush(m_colorBrushes[0]);
+
     wxRegionIterator upd(GetUpdateRegion()); // get the update rect list
     while (upd)
     {
-        vX = upd.GetX();
-        vY = upd.GetY();
+        CalcUnscrolledPosition(upd.GetX(), upd.GetY(), &vX, &vY);
         vW = upd.GetW();
         vH = upd.GetH();
 
-        // Repaint this rectangle
-        ExposeArea(vX / m_charWidth, vY / m_charHeight, vW / m_charWidth, vH / m_charHeight);
+        if (vX < bw && vY < bh)
+            dc.Blit(vX, vY, std::min(vW, bw - vX), std::min(vH, bh - vY), &m_memDC, vX, vY);
+        if (vX + vW > bw)
+            dc.DrawRectangle(std::max(vX, bw), vY, vX + vW - std::max(vX, bw), vH);
+        if (vY + vH > bh)
+            dc.DrawRectangle(vX, std::max(vY, bh), vW, vY + vH - std::max(vY, bh));
 
         upd++;
     }
 
-    GTerm::UpdateChanges();
-
-    wxLongLong ms = wxGetUTCTimeMillis();
-
-    if ((m_curX >= 0 && m_curY >= 0) && (!(GetMode() & CURSORINVISIBLE)) && ((GetMode() & BLINK)) &&
-        (ms - m_blinkTimer >= m_curBlinkRate))
-    {
-        m_blinkTimer = ms;
-
-        if (m_curBlinkRate)
-        {
-            m_curState = !m_curState;
-            if (m_curState & 1 && m_curX != -1 && m_curY != -1)
-                DoDrawCursor(m_curFG, m_curBG, m_curFlags, m_curX, m_curY, m_curChar);
-            else
-                DoDrawCursor(m_curBG, m_curFG, m_curFlags, m_curX, m_curY, m_curChar);
-        }
-    }
-
-    m_curDC = nullptr;
+    // and put the cursor over them
+    DoDrawCursor(dc);
 }
 
 void wxTerm::OnClearBg(wxEraseEvent &WXUNUSED(event))
@@ -673,9 +785,8 @@ void wxTerm::OnLeftDown(wxMouseEvent &event)
 {
     SetFocus();
 
-    ClearSelection();
-    m_selx1 = m_selx2 = event.GetX() / m_charWidth;
-    m_sely1 = m_sely2 = event.GetY() / m_charHeight;
+    SelectStart(event.GetX() / m_charWidth, event.GetY() / m_charHeight);
+    Dirty();
     /*
     int x = 0, y = 0;
     this->CalcUnscrolledPosition(event.GetX(), event.GetY(), &x, &y);
@@ -717,44 +828,74 @@ void wxTerm::OnRightDown(wxMouseEvent &event)
     PopupMenu(&menu, event.GetX(), event.GetY());
 }
 
-void wxTerm::OnMenuCopy(wxCommandEvent &event)
+static void SetClipboardText(const wxString &text)
 {
-    wxString selectedText;
-    bool lineCopy = false;
-
-    // get the selected text from the terminal^M
-    for (int y = 0; y < m_height; y++)
+    if (!text.empty())
     {
-        if (lineCopy)
-        {
-            selectedText += "\n";
-        }
-        lineCopy = false;
-        wxString line;
-        for (int x = 0; x < m_width; x++)
-        {
-            if (IsSelected(x, y))
-            {
-                char c = GetChar(x, y);
-                line << c;
-                lineCopy = true;
-            }
-        }
-        if (!line.empty())
+        if (wxTheClipboard->Open())
         {
-            line.Trim();
-            selectedText += line;
+            wxTheClipboard->SetData(new wxTextDataObject(text));
+            wxTheClipboard->Close();
         }
     }
+}
+
+// Extracts and converts a large selection on a worker thread, from lines
+// copied out of the terminal; the clipboard itself is only touched from
+// the GUI thread.
+static void CopyForClipboard(GTerm::TextSnapshot snap, const std::atomic<bool> *cancel)
+{
+    std::string text;
+
+    // every character and a newline after each line is the most it can be
+    text.resize(snap.text.size() + snap.ends.size());
+    text.resize(GTerm::ExtractText(snap, &text[0], text.size()));
+    if (*cancel)
+        return;
+    wxString str(text.data(), text.size());
+    if (*cancel)
+        return;
+    wxTheApp->CallAfter([str]() { SetClipboardText(str); });
+}
+
+void wxTerm::OnMenuCopy(wxCommandEvent &event)
+{
+    GTerm::TextSnapshot snap;
+    std::string text;
+    int64_t line1, line2;
+    int x1, x2;
 
-    if (!selectedText.empty())
+    // the selection may reach back into history, beyond what is on screen
+    if (!GetSelectionBounds(line1, x1, line2, x2))
+        return;
+
+    if ((line2 - line1 + 1) * (Width() + 1) < COPY_THREAD_THRESHOLD)
     {
-        if (wxTheClipboard->Open())
-        {
-            wxTheClipboard->SetData(new wxTextDataObject(selectedText));
-            wxTheClipboard->Close();
-        }
+        GetSelectionText(text);
+        SetClipboardText(wxString(text.data(), text.size()));
+        return;
     }
+    // only the copying of the lines is left on this thread
+    StopCopy();
+    SnapshotText(line1, x1, line2, x2, snap);
+    m_copyThread = std::thread(CopyForClipboard, std::move(snap), &m_copyCancel);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private StopCopy
+///  Waits for a copy on the worker thread to finish, telling it to give up
+///  first, so the selection last copied is the one that ends up on the
+///  clipboard
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::StopCopy()
+{
+    if (!m_copyThread.joinable())
+        return;
+    m_copyCancel = true;
+    m_copyThread.join();
+    m_copyCancel = false;
 }
 
 void wxTerm::OnMenuPaste(wxCommandEvent &event)
@@ -804,14 +945,13 @@ void wxTerm::OnMouseMove(wxMouseEvent &event)
         if (m_sely2 >= Height())
             m_sely2 = Height() - 1;
         */
-        m_selx2 = event.GetX() / m_charWidth;
-        if (m_selx2 >= Width())
-            m_selx2 = Width() - 1;
-        m_sely2 = event.GetY() / m_charHeight;
-        if (m_sely2 >= Height())
-            m_sely2 = Height() - 1;
+        // with the mouse captured it may be dragged outside the window
+        int x = std::max(0, std::min(event.GetX() / m_charWidth, Width() - 1));
+        int y = std::max(0, std::min(event.GetY() / m_charHeight, Height() - 1));
 
-        MarkSelection();
+        // only the rows whose selected part changed are redrawn
+        SelectExtend(x, y);
+        Dirty();
     }
     else
     {
@@ -820,92 +960,57 @@ void wxTerm::OnMouseMove(wxMouseEvent &event)
 }
 
 //////////////////////////////////////////////////////////////////////////////
-///  public ClearSelection
-///  De-selects all selected text
+///  private OnMouseWheel
+///  Scrolls the view through history
 ///
-///  @return void
+///  @param  event wxMouseEvent & The generated mouse event
 ///
-///  @author Derry Bryson @date 04-22-2004
+///  @return void
 //////////////////////////////////////////////////////////////////////////////
-void wxTerm::ClearSelection()
+void wxTerm::OnMouseWheel(wxMouseEvent &event)
 {
-    int x, y;
+    int lines;
 
-    m_selx1 = m_sely1 = m_selx2 = m_sely2 = 0;
-
-    for (y = 0; y < Height(); y++)
-        for (x = 0; x < Width(); x++)
-            Select(x, y, 0);
-
-    Dirty();
+    if (!event.GetWheelDelta())
+        return;
+    lines = event.GetWheelRotation() * event.GetLinesPerAction() / event.GetWheelDelta();
+    if (lines > 0)
+        ScrollTerminal(lines, true);
+    else if (lines < 0)
+        ScrollTerminal(-lines, false);
 }
 
 //////////////////////////////////////////////////////////////////////////////
-///  private MarkSelection
-///  Does _something_ as far as selecting text, but not really sure... used for SelectAll, I think
+///  public ScrollTerminal
+///  Scrolls the view back through history, or forward toward the live
+///  screen.  While scrolled back the view stays on the same lines as new
+///  output arrives.
 ///
-///  @return void
+///  @param  numLines int  The number of lines to scroll
+///  @param  scrollUp bool True to scroll back into history
 ///
-///  @author Derry Bryson @date 04-22-2004
+///  @return void
 //////////////////////////////////////////////////////////////////////////////
-void wxTerm::MarkSelection()
+void wxTerm::ScrollTerminal(int numLines, bool scrollUp)
 {
-    int x, y;
-
-    m_marking = TRUE;
-
-    for (y = 0; y < Height(); y++)
-        for (x = 0; x < Width(); x++)
-            Select(x, y, 0);
-
-    if (m_sely1 == m_sely2)
-    {
-        if (m_selx1 >= m_selx2)
-            for (x = m_selx1; x <= m_selx2; x++)
-                Select(x, m_sely1, 1);
-        else
-            for (x = m_selx2; x >= m_selx1; x--)
-                Select(x, m_sely1, 1);
-    }
-    else if (m_sely1 < m_sely2)
-    {
-        for (x = m_selx1; x < Width(); x++)
-            Select(x, m_sely1, 1);
-
-        for (y = m_sely1 + 1; y < m_sely2; y++)
-            for (x = 0; x < Width(); x++)
-                Select(x, y, 1);
-
-        for (x = 0; x <= m_selx2; x++)
-            Select(x, m_sely2, 1);
-    }
-    else
-    {
-        for (x = 0; x <= m_selx1; x++)
-            Select(x, m_sely1, 1);
-
-        for (y = m_sely2 + 1; y < m_sely1; y++)
-            for (x = 0; x < Width(); x++)
-                Select(x, y, 1);
-
-        for (x = m_selx2; x < Width(); x++)
-            Select(x, m_sely2, 1);
-    }
-
+    ScrollView(scrollUp ? numLines : -numLines);
     Dirty();
-
-    m_marking = FALSE;
 }
 
 //////////////////////////////////////////////////////////////////////////////
-///  public HasSelection
-///  Checks if any text is selected
+///  public ClearSelection
+///  De-selects all selected text
 ///
-///  @return bool Whether or not there's any text selected
+///  @return void
 ///
 ///  @author Derry Bryson @date 04-22-2004
 //////////////////////////////////////////////////////////////////////////////
-bool wxTerm::HasSelection() { return (m_selx1 != m_selx2 || m_sely1 != m_sely2); }
+void wxTerm::ClearSelection()
+{
+    SelectNone();
+
+    Dirty();
+}
 
 wxString
 //////////////////////////////////////////////////////////////////////////////
@@ -918,42 +1023,41 @@ wxString
 //////////////////////////////////////////////////////////////////////////////
 wxTerm::GetSelection()
 {
-    int x1, y1, x2, y2;
+    std::string text;
 
-    wxString sel;
-
-    if (m_sely1 <= m_sely2)
-    {
-        x1 = m_selx1;
-        y1 = m_sely1;
-        x2 = m_selx2;
-        y2 = m_sely2;
-    }
-    else
-    {
-        x1 = m_selx2;
-        y1 = m_sely2;
-        x2 = m_selx1;
-        y2 = m_sely1;
-    }
+    if (!GetSelectionText(text))
+        return wxString();
+    return wxString(text.data(), text.size());
+}
 
-    while (x1 != x2 || y1 != y2)
+//////////////////////////////////////////////////////////////////////////////
+///  public GetSelectionText
+///  Copies the selected text, history included, into a byte buffer
+///
+///  @param  text std::string & Receives the text
+///
+///  @return bool Whether or not there's any text selected
+//////////////////////////////////////////////////////////////////////////////
+bool wxTerm::GetSelectionText(std::string &text)
+{
+    int x1, x2;
+    int64_t line1, line2;
+    size_t n;
+
+    if (!GetSelectionBounds(line1, x1, line2, x2))
+        return false;
+
+    // sized for rows of the current width; lines kept from a wider
+    // screen may need a second go
+    text.resize((line2 - line1 + 1) * (Width() + 1));
+    n = ExtractText(line1, x1, line2, x2, &text[0], text.size());
+    if (n > text.size())
     {
-        if (GetChar(x1, y1))
-            sel.Append(GetChar(x1, y1));
-
-        x1++;
-        if (x1 == Width())
-        {
-            sel.Append('\n');
-            x1 = 0;
-            y1++;
-        }
+        text.resize(n);
+        ExtractText(line1, x1, line2, x2, &text[0], n);
     }
-    if (GetChar(x1, y1))
-        sel.Append(GetChar(x1, y1));
-
-    return sel;
+    text.resize(n);
+    return true;
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -966,11 +1070,8 @@ wxTerm::GetSelection()
 //////////////////////////////////////////////////////////////////////////////
 void wxTerm::SelectAll()
 {
-    m_selx1 = 0;
-    m_sely1 = 0;
-    m_selx2 = Width() - 1;
-    m_sely2 = Height() - 1;
-    MarkSelection();
+    SelectRange(0, 0, Width() - 1, Height() - 1);
+    Dirty();
 }
 
 void wxTerm::ScrollToBottom()
@@ -1007,7 +1108,9 @@ void wxTerm::ScrollToBottom()
 ///
 ///  @param  fg_color int             The index of the foreground color
 ///  @param  bg_color int             The index of the background color
-///  @param  flags    int             Modifiers for drawing the text
+///  @param  flags    int             Modifiers for drawing the text;
+///                                   BACKGROUNDDRAWN leaves the cells'
+///                                   background as it is
 ///  @param  x        int             The x position in character cells
 ///  @param  y        int             The y position in character cells
 ///  @param  len      int             The number of characters to draw
@@ -1020,10 +1123,11 @@ void wxTerm::ScrollToBottom()
 void wxTerm::DrawText(int fg_color, int bg_color, int flags, int x, int y, int len,
                       unsigned char *string)
 {
-    int t;
     int xpix = x * m_charWidth;
     int ypix = y * m_charHeight;
 
+    DamageRows(y, 1);
+
     // if (m_autoscroll)
     // {
     //     int yppu, cx, cy, vx, vy, sy;
@@ -1042,149 +1146,188 @@ void wxTerm::DrawText(int fg_color, int bg_color, int flags, int x, int y, int l
     //     });
     // }
 
-    if (flags & BOLD && m_boldStyle == BS_COLOR)
-        fg_color = (fg_color % 8) + 8;
-    if (flags & SELECTED)
-    {
-        fg_color = 0;
-        bg_color = 15;
-    }
-
-    if (flags & INVERSE)
-    {
-        t = fg_color;
-        fg_color = bg_color;
-        bg_color = t;
-    }
+    TextColours(fg_color, bg_color, flags);
 
     if (!m_curDC)
         return;
+    FlushClear();
 
-#if defined(__WXGTK__) || defined(__WXMOTIF__)
-    int i;
-
-    for (i = 0; string[i]; i++)
-        string[i] = xCharMap[string[i]];
-#endif
+    if (m_usePixels)
+    {
+        m_pixelRenderer.DrawText(x, y, string, len, PixelStyle(flags), m_colors[fg_color],
+                                 flags & BACKGROUNDDRAWN ? nullptr : &m_colors[bg_color]);
+        return;
+    }
 
-    wxString str(string, len);
+    const wxString &str = GlyphString(string, len);
 
-    if (m_boldStyle != BS_FONT)
+    UseFont(FontFor(flags));
+    if (flags & BACKGROUNDDRAWN)
     {
-        if (flags & UNDERLINE)
-            m_curDC->SetFont(m_underlinedFont);
-        else
-            m_curDC->SetFont(m_normalFont);
+        UseBackgroundMode(wxTRANSPARENT);
+        UseTextColours(fg_color, -1);
     }
     else
     {
-        if (flags & BOLD)
-        {
-            if (flags & UNDERLINE)
-                m_curDC->SetFont(m_boldUnderlinedFont);
-            else
-                m_curDC->SetFont(m_boldFont);
-        }
-        else
-        {
-            if (flags & UNDERLINE)
-                m_curDC->SetFont(m_underlinedFont);
-            else
-                m_curDC->SetFont(m_normalFont);
-        }
+        UseBackgroundMode(wxSOLID);
+        UseTextColours(fg_color, bg_color);
     }
-
-    m_curDC->SetBackgroundMode(wxSOLID);
-    m_curDC->SetTextBackground(m_colors[bg_color]);
-    m_curDC->SetTextForeground(m_colors[fg_color]);
     m_curDC->DrawText(str, xpix, ypix);
     if (flags & BOLD && m_boldStyle == BS_OVERSTRIKE)
     {
-        m_curDC->SetBackgroundMode(wxTRANSPARENT);
+        UseBackgroundMode(wxTRANSPARENT);
         m_curDC->DrawText(str, xpix + 1, ypix);
     }
 }
 
 //////////////////////////////////////////////////////////////////////////////
-///  private DoDrawCursor
-///  Does the actual work of drawing the cursor
+///  private GlyphString
+///  Puts the characters of a run into m_drawString, mapped to what the font
+///  shows them as.  The caller's buffer, which may be GTerm's own text, is
+///  left alone, and once m_drawString is big enough nothing is allocated
 ///
-///  @param  fg_color int            The index of the foreground color
-///  @param  bg_color int            The index of the background color
-///  @param  flags    int            Modifier flags
-///  @param  x        int            The x position of the cursor, in characters
-///  @param  y        int            The y position of the cursor, in characters
-///  @param  c        unsigned char  The character the cursor is over
+///  @param  string const unsigned char * The characters
+///  @param  len    int                   How many there are
 ///
-///  @return void
+///  @return const wxString & m_drawString, valid until the next call
+//////////////////////////////////////////////////////////////////////////////
+const wxString &wxTerm::GlyphString(const unsigned char *string, int len)
+{
+    int i;
+
+    if (len > MAXWIDTH)
+        len = MAXWIDTH;
+    if (m_drawString.capacity() < (size_t)len)
+        m_stats.drawAllocs++;
+
+#if defined(__WXGTK__) || defined(__WXMOTIF__)
+    for (i = 0; i < len; i++)
+        m_drawChars[i] = xCharMap[string[i]];
+#else
+    for (i = 0; i < len; i++)
+        m_drawChars[i] = string[i];
+#endif
+    // cells that were never written hold 0
+    for (i = 0; i < len; i++)
+        if (!m_drawChars[i])
+            m_drawChars[i] = ' ';
+
+    m_drawString.assign(m_drawChars, len);
+    return m_drawString;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private TextColours
+///  Turns the colours GTerm gives DrawText into the ones it draws with
 ///
-///  @author Derry Bryson @date 04-22-2004
+///  @param  fg_color int &  The index of the foreground color
+///  @param  bg_color int &  The index of the background color
+///  @param  flags    int    Modifiers for drawing the text
+///
+///  @return void
 //////////////////////////////////////////////////////////////////////////////
-void wxTerm::DoDrawCursor(int fg_color, int bg_color, int flags, int x, int y, unsigned char c)
+void wxTerm::TextColours(int &fg_color, int &bg_color, int flags)
 {
+    int t;
+
     if (flags & BOLD && m_boldStyle == BS_COLOR)
         fg_color = (fg_color % 8) + 8;
+    if (flags & SELECTED)
+    {
+        fg_color = 0;
+        bg_color = 15;
+    }
 
     if (flags & INVERSE)
     {
-        int t = fg_color;
+        t = fg_color;
         fg_color = bg_color;
         bg_color = t;
     }
+}
 
-    if (!m_curDC)
-        return;
+//////////////////////////////////////////////////////////////////////////////
+///  public virtual TextBackground
+///  Gives the colour DrawText fills behind text, so that a two-pass update
+///  can clear it first.  This virtual function is called from
+///  GTerm::update_changes.
+///
+///  @param  fg_color int  The index of the foreground color
+///  @param  bg_color int  The index of the background color
+///  @param  flags    int  Modifiers for drawing the text
+///
+///  @return int The index of the background colour
+//////////////////////////////////////////////////////////////////////////////
+int wxTerm::TextBackground(int fg_color, int bg_color, int flags)
+{
+    TextColours(fg_color, bg_color, flags);
+    return bg_color;
+}
 
-#if defined(__WXGTK__) || defined(__WXMOTIF__)
-    c = xCharMap[c];
-#endif
+//////////////////////////////////////////////////////////////////////////////
+///  private DoDrawCursor
+///  Does the actual work of drawing the cursor, over the bitmap once it has
+///  been copied to the window, unless it is blinked off
+///
+///  @param  dc wxDC & The window's paint DC
+///
+///  @return void
+///
+///  @author Derry Bryson @date 04-22-2004
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::DoDrawCursor(wxDC &dc)
+{
+    int fg_color = m_curFG, bg_color = m_curBG, x, y;
 
-    wxString str((char)c);
+    if (m_curX < 0 || m_curY < 0 || !(m_curState & 1))
+        return;
 
-    if (m_boldStyle != BS_FONT)
-    {
-        if (flags & UNDERLINE)
-            m_curDC->SetFont(m_underlinedFont);
-        else
-            m_curDC->SetFont(m_normalFont);
-    }
-    else
+    if (m_curFlags & BOLD && m_boldStyle == BS_COLOR)
+        fg_color = (fg_color % 8) + 8;
+
+    if (m_curFlags & INVERSE)
     {
-        if (flags & BOLD)
-        {
-            if (flags & UNDERLINE)
-                m_curDC->SetFont(m_boldUnderlinedFont);
-            else
-                m_curDC->SetFont(m_boldFont);
-        }
-        else
-        {
-            if (flags & UNDERLINE)
-                m_curDC->SetFont(m_underlinedFont);
-            else
-                m_curDC->SetFont(m_normalFont);
-        }
+        int t = fg_color;
+        fg_color = bg_color;
+        bg_color = t;
     }
 
-    x = x * m_charWidth;
-    y = y * m_charHeight;
-    m_curDC->SetBackgroundMode(wxSOLID);
-    m_curDC->SetTextBackground(m_colors[fg_color]);
-    m_curDC->SetTextForeground(m_colors[bg_color]);
-    m_curDC->DrawText(str, x, y);
-    if (flags & BOLD && m_boldStyle == BS_OVERSTRIKE)
-        m_curDC->DrawText(str, x + 1, y);
+    const wxString &str = GlyphString(&m_curChar, 1);
+
+    x = m_curX * m_charWidth;
+    y = m_curY * m_charHeight;
+    dc.SetFont(FontFor(m_curFlags));
+    dc.SetBackgroundMode(wxSOLID);
+    dc.SetTextForeground(m_colors[bg_color]);
+    dc.SetTextBackground(m_colors[fg_color]);
+    dc.DrawText(str, x, y);
+    if (m_curFlags & BOLD && m_boldStyle == BS_OVERSTRIKE)
+        dc.DrawText(str, x + 1, y);
+}
 
-    if (m_autoscroll)
-    {
-        ScrollToBottom();
-    }
+//////////////////////////////////////////////////////////////////////////////
+///  private RefreshCursor
+///  Has the window repaint the cursor's cell, and nothing else
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::RefreshCursor()
+{
+    int x, y;
+
+    if (m_curX < 0 || m_curY < 0)
+        return;
+    CalcScrolledPosition(m_curX * m_charWidth, m_curY * m_charHeight, &x, &y);
+    // an overstruck bold cursor spills a pixel to the right
+    RefreshRect(wxRect(x, y, m_charWidth + 1, m_charHeight), false);
+    m_stats.cursorRefreshes++;
 }
 
 //////////////////////////////////////////////////////////////////////////////
 ///  public virtual DrawCursor
 ///  Draws the cursor on the terminal widget.  This virtual function is called
-///  from GTerm::update_changes.
+///  from GTerm::update_changes.  The cursor is only remembered here, and its
+///  old and new cells refreshed if it changed; OnPaint draws it
 ///
 ///  @param  fg_color int            The index of the foreground color
 ///  @param  bg_color int            The index of the background color
@@ -1199,18 +1342,155 @@ void wxTerm::DoDrawCursor(int fg_color, int bg_color, int flags, int x, int y, u
 //////////////////////////////////////////////////////////////////////////////
 void wxTerm::DrawCursor(int fg_color, int bg_color, int flags, int x, int y, unsigned char c)
 {
-    m_curX = x;
-    m_curY = y;
-    m_curFG = fg_color;
-    m_curBG = bg_color, m_curFlags = flags;
-    m_curChar = c;
+    if (x != m_curX || y != m_curY || fg_color != m_curFG || bg_color != m_curBG ||
+        flags != m_curFlags || c != m_curChar)
+    {
+        RefreshCursor();
+        m_curX = x;
+        m_curY = y;
+        m_curFG = fg_color;
+        m_curBG = bg_color, m_curFlags = flags;
+        m_curChar = c;
+        // a cursor that moves is shown straight away
+        m_curState = 1;
+        m_blinkTimer = wxGetUTCTimeMillis();
+        RefreshCursor();
+        UpdateTimers();
+    }
+
+    if (m_autoscroll)
+    {
+        ScrollToBottom();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public virtual HideCursor
+///  Takes the cursor off the terminal widget.  This virtual function is
+///  called from GTerm::update_changes.
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::HideCursor()
+{
+    RefreshCursor();
+    m_curX = -1;
+    m_curY = -1;
+    UpdateTimers();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private Blink
+///  Called by the shared blink clock.  Refreshes the cursor's cell if it
+///  turned on or off, and the cells of any blinking text
+///
+///  @param  now wxLongLong  The time of the clock's tick
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::Blink(wxLongLong now)
+{
+    int on;
+
+    m_stats.blinkWakeups++;
+    // blinking text keeps to the clock, whatever the cursor does
+    if (BlinkText(!wxTermBlinkClock::CursorOn(now, m_curBlinkRate)))
+        Dirty();
+
+    if (m_curX < 0 || !m_hasFocus)
+        return;
+    on = now - m_blinkTimer < m_curBlinkRate || wxTermBlinkClock::CursorOn(now, m_curBlinkRate);
+    if (on != m_curState)
+    {
+        m_curState = on;
+        RefreshCursor();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private UpdateTimers
+///  Joins the shared blink clock while the cursor can be seen blinking or
+///  there is blinking text on screen, and runs m_timer while a
+///  synchronized update is holding back drawing, so an idle terminal has
+///  no timers running at all
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::UpdateTimers()
+{
+    if (m_curBlinkRate && !IsParseOnly() && ((m_curX >= 0 && m_hasFocus) || HasBlinkText()))
+        wxTermBlinkClock::Add(this);
+    else
+    {
+        wxTermBlinkClock::Remove(this);
+        // it stops blinking shown
+        if (BlinkText(false) && !IsParseOnly())
+            Dirty();
+        if (!m_curState)
+        {
+            // it stops blinking on
+            m_curState = 1;
+            RefreshCursor();
+        }
+    }
+
+    if (IsSyncUpdate() && !IsParseOnly())
+    {
+        if (!m_timer.IsRunning())
+            m_timer.Start(TIMER_TIMEOUT);
+    }
+    else if (m_timer.IsRunning())
+        m_timer.Stop();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private UpdateParseOnly
+///  Only parses input while the terminal can't be seen, on a notebook page
+///  not selected or in a minimised frame, drawing nothing until it is
+///  shown again.  That is noticed when input arrives or it is painted
+///
+///  @return bool true if it is not shown
+//////////////////////////////////////////////////////////////////////////////
+bool wxTerm::UpdateParseOnly()
+{
+    wxTopLevelWindow *frame = wxDynamicCast(wxGetTopLevelParent(this), wxTopLevelWindow);
+    bool hidden = !IsShownOnScreen() || (frame && frame->IsIconized());
 
-    DoDrawCursor(fg_color, bg_color, flags, x, y, c);
+    if (hidden != IsParseOnly())
+    {
+        SetParseOnly(hidden);
+        // every row is marked dirty, for the paint or Dirty that follows
+        if (!hidden)
+            m_stats.reshows++;
+        UpdateTimers();
+    }
+    return hidden;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public static GetWakeupsPerSecond
+///  Reports how often the timers of all the terminals have fired since the
+///  last time this was called
+///
+///  @return double Timer wakeups per second
+//////////////////////////////////////////////////////////////////////////////
+double wxTerm::GetWakeupsPerSecond()
+{
+    static wxLongLong last_time = wxGetUTCTimeMillis();
+    static unsigned long long last_wakeups = 0;
+    wxLongLong now = wxGetUTCTimeMillis();
+    long long ms = (now - last_time).GetValue();
+    double rate;
+
+    rate = ms > 0 ? (s_wakeups - last_wakeups) * 1000.0 / ms : 0;
+    last_time = now;
+    last_wakeups = s_wakeups;
+    return rate;
 }
 
 //////////////////////////////////////////////////////////////////////////////
 ///  private OnTimer
-///  Blinks the cursor each time it goes off
+///  Checks whether a synchronized update has finished, or run out of time
 ///
 ///  @param  event wxTimerEvent & The generated timer event
 ///
@@ -1220,16 +1500,80 @@ void wxTerm::DrawCursor(int fg_color, int bg_color, int flags, int x, int y, uns
 //////////////////////////////////////////////////////////////////////////////
 void wxTerm::OnTimer(wxTimerEvent &WXUNUSED(event))
 {
+    s_wakeups++;
+    m_stats.timerWakeups++;
     if (m_init)
         return;
 
     if (changes_pending())
         Dirty();
+    UpdateTimers();
 }
 
+//////////////////////////////////////////////////////////////////////////////
+///  public virtual Dirty
+///  Called when the terminal has changed; once the events queued before
+///  it are handled, the bitmap is brought up to date and the rows drawn
+///  into it are repainted
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
 void wxTerm::Dirty()
 {
-    CallAfter([=]() { Refresh(); });
+    CallAfter([=]() { UpdateBitmap(); });
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private UpdateBitmap
+///  Redraws the dirty parts of the bitmap and has the window repaint the
+///  rows they lie in, the width of the grid, rather than all of it
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::UpdateBitmap()
+{
+    int x, y;
+
+    if (!m_bitmap)
+        return;
+
+    unsigned long changes = m_stats.dcStateChanges;
+    unsigned long allocs = m_stats.drawAllocs;
+    m_damageTop = m_height;
+    m_damageBottom = -1;
+    GTerm::UpdateChanges();
+    FlushClear();
+    if (m_usePixels)
+        FlushPixels();
+    if (m_damageTop > m_damageBottom)
+        return;
+
+    m_stats.frames++;
+    m_stats.lastFrameDCChanges = m_stats.dcStateChanges - changes;
+    if (m_stats.lastFrameDCChanges > m_stats.maxFrameDCChanges)
+        m_stats.maxFrameDCChanges = m_stats.lastFrameDCChanges;
+    m_stats.lastFrameAllocs = m_stats.drawAllocs - allocs;
+
+    CalcScrolledPosition(0, m_damageTop * m_charHeight, &x, &y);
+    RefreshRect(wxRect(x, y, m_width * m_charWidth, (m_damageBottom - m_damageTop + 1) * m_charHeight),
+                false);
+    m_damageTop = m_height;
+    m_damageBottom = -1;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private DamageRows
+///  Notes rows drawn into the bitmap, for UpdateBitmap to repaint
+///
+///  @param  y int  The first row
+///  @param  h int  How many rows
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::DamageRows(int y, int h)
+{
+    m_damageTop = std::min(m_damageTop, y);
+    m_damageBottom = std::max(m_damageBottom, y + h - 1);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1250,9 +1594,7 @@ void wxTerm::Dirty()
 //////////////////////////////////////////////////////////////////////////////
 void wxTerm::MoveChars(int sx, int sy, int dx, int dy, int w, int h)
 {
-    if (!m_marking)
-        ClearSelection();
-
+    DamageRows(dy, h);
     sx = sx * m_charWidth;
     sy = sy * m_charHeight;
     dx = dx * m_charWidth;
@@ -1260,10 +1602,18 @@ void wxTerm::MoveChars(int sx, int sy, int dx, int dy, int w, int h)
     w = w * m_charWidth;
     h = h * m_charHeight;
 
-    if (m_curDC)
+    if (m_curDC && m_usePixels)
+    {
+        FlushClear();
+        m_pixelRenderer.MoveRect(sx / m_charWidth, sy / m_charHeight, dx / m_charWidth,
+                                 dy / m_charHeight, w / m_charWidth, h / m_charHeight);
+    }
+    else if (m_curDC)
     {
-        m_memDC.Blit(0, 0, w, h, m_curDC, sx, sy);
-        m_curDC->Blit(dx, dy, w, h, &m_memDC, 0, 0);
+        FlushClear();
+        wxMemoryDC &scratch = TermResources::Scratch(w, h);
+        scratch.Blit(0, 0, w, h, m_curDC, sx, sy);
+        m_curDC->Blit(dx, dy, w, h, &scratch, 0, 0);
     }
 }
 
@@ -1284,17 +1634,251 @@ void wxTerm::MoveChars(int sx, int sy, int dx, int dy, int w, int h)
 //////////////////////////////////////////////////////////////////////////////
 void wxTerm::ClearChars(int clear_bg_color, int x, int y, int w, int h)
 {
-    if (m_curDC)
+    PendingClear &p = m_pendingClear;
+
+    m_stats.clears++;
+    DamageRows(y, h);
+
+    // update_changes clears a row at a time, so runs in the rows below
+    // usually continue the last one
+    if (p.color == clear_bg_color)
+    {
+        if (p.x == x && p.w == w && p.y + p.h == y)
+        {
+            p.h += h;
+            return;
+        }
+        if (p.y == y && p.h == h && p.x + p.w == x)
+        {
+            p.w += w;
+            return;
+        }
+    }
+
+    FlushClear();
+    p.color = clear_bg_color;
+    p.x = x;
+    p.y = y;
+    p.w = w;
+    p.h = h;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private FlushClear
+///  Draws the rectangle ClearChars is holding back.  Anything else that
+///  draws into the bitmap, or shows it, calls this first
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::FlushClear()
+{
+    PendingClear &p = m_pendingClear;
+
+    if (p.color < 0)
+        return;
+
+    if (m_curDC && m_usePixels)
+    {
+        m_pixelRenderer.FillRect(p.x, p.y, p.w, p.h, m_colors[p.color]);
+        m_stats.clearRects++;
+    }
+    else if (m_curDC)
+    {
+        UseFill(p.color);
+        m_curDC->DrawRectangle(p.x * m_charWidth, p.y * m_charHeight, p.w * m_charWidth,
+                               p.h * m_charHeight);
+        m_stats.clearRects++;
+    }
+    p.color = -1;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public SetPixelRendering
+///  Chooses between drawing through the bitmap's DC and drawing through a
+///  PixelRenderer, which blends pre-rasterised glyphs into a buffer of its
+///  own and copies the changes into the bitmap before it is shown
+///
+///  @param  on bool  true for the PixelRenderer
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::SetPixelRendering(bool on)
+{
+    if (on == m_usePixels)
+        return;
+    FlushClear();
+    m_usePixels = on;
+    if (on)
+        m_pixelRenderer.Resize(m_width, m_height, m_charWidth, m_charHeight);
+    InvalidateDCState();
+    ExposeAll();
+    Refresh();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private PixelStyle
+///  Picks the PixelRenderer style for text drawn with the given flags, as
+///  FontFor does for the DC
+///
+///  @param  flags int  Modifiers for drawing the text
+///
+///  @return int PixelRenderer::STYLE_ flags
+//////////////////////////////////////////////////////////////////////////////
+int wxTerm::PixelStyle(int flags)
+{
+    int style = 0;
+
+    if (flags & UNDERLINE)
+        style |= PixelRenderer::STYLE_UNDERLINE;
+    if (flags & BOLD && m_boldStyle == BS_FONT)
+        style |= PixelRenderer::STYLE_BOLD;
+    if (flags & BOLD && m_boldStyle == BS_OVERSTRIKE)
+        style |= PixelRenderer::STYLE_OVERSTRIKE;
+    return style;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private FlushPixels
+///  Copies what the PixelRenderer has drawn into the bitmap
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::FlushPixels()
+{
+    if (!m_pixelRenderer.HasDamage())
+        return;
+    // the bitmap's pixels can't be reached while it is selected into a DC
+    m_memDC.SelectObject(wxNullBitmap);
+    m_pixelRenderer.Flush(*m_bitmap);
+    m_memDC.SelectObject(*m_bitmap);
+    InvalidateDCState();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private InvalidateDCState
+///  Forgets what the drawing DC was set to, after the DC, the fonts or the
+///  colours change
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::InvalidateDCState()
+{
+    m_dcState.font = nullptr;
+    m_dcState.textFG = -1;
+    m_dcState.textBG = -1;
+    m_dcState.backgroundMode = -1;
+    m_dcState.fill = -1;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private FontFor
+///  Picks the font for text drawn with the given flags
+///
+///  @param  flags int  Modifiers for drawing the text
+///
+///  @return const wxFont & The font to use
+//////////////////////////////////////////////////////////////////////////////
+const wxFont &wxTerm::FontFor(int flags)
+{
+    int style = flags & UNDERLINE ? PixelRenderer::STYLE_UNDERLINE : 0;
+
+    if (m_boldStyle == BS_FONT && (flags & BOLD))
+        style |= PixelRenderer::STYLE_BOLD;
+    return m_resources->Font(style);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private UseFont
+///  Selects a font into the drawing DC unless it is already there
+///
+///  @param  font const wxFont & One of the terminal's fonts
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::UseFont(const wxFont &font)
+{
+    if (m_dcState.font == &font)
+    {
+        m_stats.dcStateSkipped++;
+        return;
+    }
+    m_curDC->SetFont(font);
+    m_dcState.font = &font;
+    m_stats.dcStateChanges++;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private UseTextColours
+///  Sets the text colours of the drawing DC where they differ
+///
+///  @param  fg_color int  The index of the foreground color
+///  @param  bg_color int  The index of the background color
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::UseTextColours(int fg_color, int bg_color)
+{
+    if (m_dcState.textFG != fg_color)
+    {
+        m_curDC->SetTextForeground(m_colors[fg_color]);
+        m_dcState.textFG = fg_color;
+        m_stats.dcStateChanges++;
+    }
+    else
+        m_stats.dcStateSkipped++;
+
+    if (bg_color < 0)
+        return;
+    if (m_dcState.textBG != bg_color)
+    {
+        m_curDC->SetTextBackground(m_colors[bg_color]);
+        m_dcState.textBG = bg_color;
+        m_stats.dcStateChanges++;
+    }
+    else
+        m_stats.dcStateSkipped++;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private UseBackgroundMode
+///  Sets the background mode of the drawing DC unless it is already set
+///
+///  @param  mode int  wxSOLID or wxTRANSPARENT
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::UseBackgroundMode(int mode)
+{
+    if (m_dcState.backgroundMode == mode)
     {
-        int xpix = x * m_charWidth;
-        int ypix = y * m_charHeight;
-        int wpix = w * m_charWidth;
-        int hpix = h * m_charHeight;
+        m_stats.dcStateSkipped++;
+        return;
+    }
+    m_curDC->SetBackgroundMode(mode);
+    m_dcState.backgroundMode = mode;
+    m_stats.dcStateChanges++;
+}
 
-        m_curDC->SetPen(m_colorPens[clear_bg_color]);
-        m_curDC->SetBrush(wxBrush(m_colors[clear_bg_color], wxSOLID));
-        m_curDC->DrawRectangle(xpix, ypix, wpix, hpix);
+//////////////////////////////////////////////////////////////////////////////
+///  private UseFill
+///  Sets the pen and brush of the drawing DC to a colour unless they are
+///  already that colour
+///
+///  @param  color int  The index of the colour
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::UseFill(int color)
+{
+    if (m_dcState.fill == color)
+    {
+        m_stats.dcStateSkipped++;
+        return;
     }
+    m_curDC->SetPen(m_colorPens[color]);
+    m_curDC->SetBrush(m_colorBrushes[color]);
+    m_dcState.fill = color;
+    m_stats.dcStateChanges++;
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1309,19 +1893,22 @@ void wxTerm::ClearChars(int clear_bg_color, int x, int y, int w, int h)
 //////////////////////////////////////////////////////////////////////////////
 void wxTerm::ModeChange(int state)
 {
-    ClearSelection();
+    bool pc = (state & PC) != 0;
 
-    if (state & GTerm::PC)
-    {
-        m_colors = m_pc_colors;
-        m_colorPens = m_pc_colorPens;
-    }
-    else
+    // a switch between the PC and VT100 palettes redraws everything; other
+    // modes, as SGR sets them, leave the selection and the DC alone
+    if (m_colors != m_resources->Colors(pc))
     {
-        m_colors = m_vt_colors;
-        m_colorPens = m_vt_colorPens;
+        // the held back clear is in the old palette
+        FlushClear();
+        ClearSelection();
+        UsePalette();
+        ExposeAll();
+        Refresh();
+        m_thumbRows.clear();
     }
     GTerm /*lnet*/ ::ModeChange(state);
+    UpdateTimers();
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1351,15 +1938,11 @@ void wxTerm::UpdateSize()
     }
 
     m_inUpdateSize = true;
-    int charWidth, charHeight;
-
-    wxClientDC dc(this);
-    dc.SetFont(m_normalFont);
-    dc.GetTextExtent("M", &charWidth, &charHeight);
+    MeasureChars();
 
     wxSize currentClientSize = GetVirtualSize(); // GetClientSize();//
-    int numCharsInLine = currentClientSize.GetX() / charWidth;
-    int numLinesShown = currentClientSize.GetY() / charHeight;
+    int numCharsInLine = currentClientSize.GetX() / m_charWidth;
+    int numLinesShown = currentClientSize.GetY() / m_charHeight;
 
 
     if ((numCharsInLine != m_charsInLine) || (numLinesShown != m_linesDisplayed))
@@ -1386,12 +1969,68 @@ void wxTerm::UpdateSize()
     }
 
     m_inUpdateSize = false;
+}
 
-    CallAfter([=]()
-    {
-        ExposeArea(0, 0, m_width, m_height);
-        Dirty();
-    });
+//////////////////////////////////////////////////////////////////////////////
+///  private AcquireResources
+///  Switches to the shared resources for a font and palettes, letting go
+///  of the ones used before
+///
+///  @param  font     const wxFont &   The normal font
+///  @param  vtColors const wxColour[] The VT100 colours
+///  @param  pcColors const wxColour[] The PC colours
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::AcquireResources(const wxFont &font, const wxColour vtColors[16], const wxColour pcColors[16])
+{
+    TermResources *old = m_resources;
+
+#if defined(__WXGTK__) || defined(__WXMOTIF__)
+    m_resources = TermResources::Acquire(font, vtColors, pcColors, xCharMap);
+#else
+    m_resources = TermResources::Acquire(font, vtColors, pcColors, nullptr);
+#endif
+    // the pixels stop using the old glyphs before they can go
+    m_metricsValid = false;
+    MeasureChars();
+    TermResources::Release(old);
+    UsePalette();
+    m_thumbRows.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private UsePalette
+///  Draws with the PC colours in PC mode and the VT100 ones otherwise
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::UsePalette()
+{
+    bool pc = (GetMode() & PC) != 0;
+
+    m_colors = m_resources->Colors(pc);
+    m_colorPens = m_resources->Pens(pc);
+    m_colorBrushes = m_resources->Brushes(pc);
+    InvalidateDCState();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private MeasureChars
+///  Finds the size of a character cell, unless the font hasn't changed
+///  since it was last measured, and has the pixels drawn with glyphs of
+///  that size
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::MeasureChars()
+{
+    if (m_metricsValid)
+        return;
+
+    m_resources->Measure(this, m_boldStyle == BS_FONT, m_charWidth, m_charHeight);
+    m_pixelRenderer.SetGlyphs(m_resources->Glyphs(m_boldStyle == BS_FONT));
+    m_metricsValid = true;
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1407,7 +2046,9 @@ void wxTerm::UpdateSize()
 //////////////////////////////////////////////////////////////////////////////
 void wxTerm::ResizeTerminal(int width, int height)
 {
-    int w, h;
+    wxStopWatch sw;
+    long long usecs;
+    int w, h, bw, bh;
 
     // code makes assumptions about max line width and max line count
     int set_width = std::min(MAXWIDTH, width);
@@ -1418,26 +2059,38 @@ void wxTerm::ResizeTerminal(int width, int height)
     /*
     **  Determine window size from current font
     */
-    wxClientDC dc(this);
-
-    if (m_boldStyle != BS_FONT)
-        dc.SetFont(m_normalFont);
-    else
-        dc.SetFont(m_boldFont);
-    dc.GetTextExtent("M", &m_charWidth, &m_charHeight);
+    MeasureChars();
+    m_pendingClear.color = -1; // ExposeAll redraws it anyway
     w = set_width * m_charWidth;
     h = set_height * m_charHeight;
 
     /*
-    **  Create our bitmap for copying
+    **  Create the bitmap we draw into.  It only ever grows, and by half
+    **  again, so a window being dragged larger doesn't get a new one at
+    **  every step
     */
-    if (m_bitmap)
+    bw = m_bitmap ? m_bitmap->GetWidth() : 0;
+    bh = m_bitmap ? m_bitmap->GetHeight() : 0;
+    if (w > bw || h > bh)
     {
-        m_memDC.SelectObject(wxNullBitmap);
-        delete m_bitmap;
+        if (w > bw)
+            bw = std::max(w, BITMAP_GROWTH(bw));
+        if (h > bh)
+            bh = std::max(h, BITMAP_GROWTH(bh));
+
+        if (m_bitmap)
+        {
+            m_memDC.SelectObject(wxNullBitmap);
+            delete m_bitmap;
+        }
+        m_bitmap = new wxBitmap(bw, bh);
+        m_memDC.SelectObject(*m_bitmap);
+        m_stats.bitmapAllocs++;
+        InvalidateDCState();
     }
-    m_bitmap = new wxBitmap(w, h);
-    m_memDC.SelectObject(*m_bitmap);
+    m_curDC = &m_memDC;
+    if (m_usePixels)
+        m_pixelRenderer.Resize(set_width, set_height, m_charWidth, m_charHeight);
 
     /*
     **  Set window size
@@ -1458,6 +2111,13 @@ void wxTerm::ResizeTerminal(int width, int height)
     m_height = set_height;
 
     ExposeAll();
+    Dirty();
+
+    usecs = sw.TimeInMicro().GetValue();
+    m_stats.resizes++;
+    m_stats.lastResizeUsecs = usecs;
+    if (usecs > m_stats.maxResizeUsecs)
+        m_stats.maxResizeUsecs = usecs;
     /*
     **  Send event
     */
@@ -1495,11 +2155,458 @@ void wxTerm::RequestSizeChange(int w, int h) { ResizeTerminal(w, h); }
 //////////////////////////////////////////////////////////////////////////////
 void wxTerm::ProcessInput(int len, const char *data)
 {
+    int n;
+
     // ClearSelection();
 
-    GTerm::ProcessInput(len, data);
+    if (HasPendingInput())
+    {
+        // queue behind the backlog, which OnIdle is working through
+        QueueInput(len, data);
+        return;
+    }
 
-    Dirty();
+    n = ParseSlice(len, data);
+    if (n < len)
+    {
+        m_pendingInput.assign(data + n, len - n);
+        m_pendingPos = 0;
+    }
+
+    // inside a synchronized update the frame is painted when it ends,
+    // or by OnTimer if the application never ends it
+    if (UpdateParseOnly())
+        m_stats.hiddenSlices++;
+    else if (!IsSyncUpdate())
+        Dirty();
+    UpdateTimers();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private ParseSlice
+///  Parses as much of the data as the parse budget allows
+///
+///  @param  len  int          The number of characters available
+///  @param  data const char * The received text
+///
+///  @return int The number of characters consumed
+//////////////////////////////////////////////////////////////////////////////
+int wxTerm::ParseSlice(int len, const char *data)
+{
+    wxStopWatch sw;
+    long long usecs;
+    int n;
+
+    n = ProcessInputSlice(len, data, m_parseBudgetBytes, m_parseBudgetUsecs);
+
+    usecs = sw.TimeInMicro().GetValue();
+    m_stats.slices++;
+    m_stats.bytesParsed += n;
+    m_stats.lastSliceUsecs = usecs;
+    m_stats.totalSliceUsecs += usecs;
+    if (usecs > m_stats.maxSliceUsecs)
+        m_stats.maxSliceUsecs = usecs;
+    return n;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private OnIdle
+///  Parses the next slice of input that did not fit in an earlier budget
+///
+///  @param  event wxIdleEvent & The generated idle event
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::OnIdle(wxIdleEvent &event)
+{
+    event.Skip();
+    if (!HasPendingInput())
+        return;
+
+    m_pendingPos += ParseSlice(m_pendingInput.size() - m_pendingPos,
+                               m_pendingInput.data() + m_pendingPos);
+    if (HasPendingInput())
+        event.RequestMore();
+    else
+    {
+        m_pendingInput.clear();
+        m_pendingPos = 0;
+    }
+
+    if (UpdateParseOnly())
+        m_stats.hiddenSlices++;
+    else if (!IsSyncUpdate())
+        Dirty();
+    UpdateTimers();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public QueueInput
+///  Adds received text to the backlog without parsing any of it.  The
+///  backlog is parsed in idle time, after pending key and mouse events.
+///
+///  @param  len  int          The number of characters received
+///  @param  data const char * The received text
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::QueueInput(int len, const char *data)
+{
+    if (!HasPendingInput())
+    {
+        m_pendingInput.clear();
+        m_pendingPos = 0;
+    }
+    else if (m_pendingPos > m_pendingInput.size() / 2)
+    {
+        m_pendingInput.erase(0, m_pendingPos);
+        m_pendingPos = 0;
+    }
+    m_pendingInput.append(data, len);
+    wxWakeUpIdle();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public DiscardPendingInput
+///  Throws away received text that has not been parsed yet.  It may have
+///  been cut in the middle of an escape sequence, so the parser goes back
+///  to reading text rather than take the host's next output as the rest
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::DiscardPendingInput()
+{
+    if (!HasPendingInput())
+        return;
+    m_stats.discardedBytes += m_pendingInput.size() - m_pendingPos;
+    m_pendingInput.clear();
+    m_pendingPos = 0;
+    CancelSequence();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private SendKey
+///  Sends a translated key press to the host
+///
+///  @param  len  int          The number of characters
+///  @param  data const char * The characters
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::SendKey(int len, const char *data)
+{
+    uint32_t gap;
+    long long usecs;
+
+    // after ^C or ^Z the host stops, so output still queued is stale
+    if (m_discardOnInterrupt && len == 1 && (data[0] == 3 || data[0] == 26))
+        DiscardPendingInput();
+
+    // typing goes back to following output
+    if (GetViewOffset())
+        ScrollTerminal(GetViewOffset(), false);
+
+    ProcessOutput(len, data);
+
+    m_stats.keys++;
+    // the key waited in the queue, or behind parsing, from its timestamp;
+    // without one there is nothing to measure from
+    if (!m_keyTimestamp)
+        return;
+    gap = (uint32_t)wxGetUTCTimeMillis().GetValue() - (uint32_t)m_keyTimestamp;
+    if (!m_keyClockKnown || (int32_t)(gap - m_keyClockBase) < 0)
+    {
+        m_keyClockBase = gap;
+        m_keyClockKnown = true;
+    }
+    usecs = (long long)(uint32_t)(gap - m_keyClockBase) * 1000;
+    m_stats.lastKeyUsecs = usecs;
+    if (usecs > m_stats.maxKeyUsecs)
+        m_stats.maxKeyUsecs = usecs;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public SetParseBudget
+///  Limits how much received text is parsed before the GUI gets a turn;
+///  the rest is parsed in idle time.  0 means no limit.
+///
+///  @param  usecs int The time limit in microseconds
+///  @param  bytes int The limit in characters
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::SetParseBudget(int usecs, int bytes)
+{
+    m_parseBudgetUsecs = usecs;
+    m_parseBudgetBytes = bytes;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public GetStats
+///  Returns counters describing how input has been parsed, and the
+///  window resized, since the last ResetStats
+///
+///  @return wxTerm::Stats The counters
+//////////////////////////////////////////////////////////////////////////////
+wxTerm::Stats wxTerm::GetStats()
+{
+    m_stats.pendingBytes = m_pendingInput.size() - m_pendingPos;
+    return m_stats;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public ResetStats
+///  Sets all the counters GetStats returns back to zero
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::ResetStats() { memset(&m_stats, 0, sizeof(m_stats)); }
+
+//////////////////////////////////////////////////////////////////////////////
+///  public BenchmarkRedraw
+///  Redraws the whole terminal into the bitmap a number of times with each
+///  draw order through the DC, and then through the PixelRenderer, to
+///  compare them.  The settings in use are left as they were
+///
+///  @param  frames int  How many redraws to time for each
+///
+///  @return wxTerm::RedrawTimes The time and DC state changes each took
+//////////////////////////////////////////////////////////////////////////////
+wxTerm::RedrawTimes wxTerm::BenchmarkRedraw(int frames)
+{
+    RedrawTimes times;
+    bool two_pass, pixels;
+    unsigned long changes, allocs;
+    int pass, i;
+
+    memset(&times, 0, sizeof(times));
+    if (!m_curDC || IsSyncUpdate())
+        return times;
+
+    two_pass = GetTwoPassDraw();
+    pixels = m_usePixels;
+    for (pass = 0; pass < 3; pass++)
+    {
+        SetTwoPassDraw(pass == 1);
+        SetPixelRendering(pass == 2);
+        changes = m_stats.dcStateChanges;
+        allocs = m_stats.drawAllocs;
+        wxStopWatch sw;
+        for (i = 0; i < frames; i++)
+        {
+            ExposeAll();
+            GTerm::UpdateChanges();
+            FlushClear();
+            if (m_usePixels)
+                FlushPixels();
+        }
+        if (pass == 0)
+        {
+            times.singlePassUsecs = sw.TimeInMicro().GetValue();
+            times.singlePassDCChanges = m_stats.dcStateChanges - changes;
+            times.singlePassAllocs = m_stats.drawAllocs - allocs;
+        }
+        else if (pass == 1)
+        {
+            times.twoPassUsecs = sw.TimeInMicro().GetValue();
+            times.twoPassDCChanges = m_stats.dcStateChanges - changes;
+            times.twoPassAllocs = m_stats.drawAllocs - allocs;
+        }
+        else
+            times.pixelUsecs = sw.TimeInMicro().GetValue();
+    }
+    SetTwoPassDraw(two_pass);
+    SetPixelRendering(pixels);
+    ExposeAll();
+    Refresh();
+    return times;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public BenchmarkPixelThreads
+///  Redraws the whole terminal through the PixelRenderer a number of times
+///  with each number of threads from 1 to maxThreads, to see how it
+///  scales.  The settings in use are left as they were
+///
+///  @param  frames     int  How many redraws to time for each
+///  @param  maxThreads int  The most threads to try
+///
+///  @return std::vector<long long> The microseconds taken with i + 1 threads
+///                                 at [i], or nothing if it couldn't draw
+//////////////////////////////////////////////////////////////////////////////
+std::vector<long long> wxTerm::BenchmarkPixelThreads(int frames, int maxThreads)
+{
+    std::vector<long long> usecs;
+    bool pixels;
+    int threads, n, i;
+
+    if (!m_curDC || IsSyncUpdate())
+        return usecs;
+
+    pixels = m_usePixels;
+    threads = GetPixelThreads();
+    SetPixelRendering(true);
+    for (n = 1; n <= maxThreads; n++)
+    {
+        SetPixelThreads(n);
+        wxStopWatch sw;
+        for (i = 0; i < frames; i++)
+        {
+            ExposeAll();
+            GTerm::UpdateChanges();
+            FlushClear();
+            FlushPixels();
+        }
+        usecs.push_back(sw.TimeInMicro().GetValue());
+    }
+    SetPixelThreads(threads);
+    SetPixelRendering(pixels);
+    ExposeAll();
+    Refresh();
+    return usecs;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public GetMemoryUse
+///  Measures the memory the terminal uses, telling what it has to itself
+///  from its share of what it has in common with other terminals
+///
+///  @return wxTerm::MemoryUse The sizes
+//////////////////////////////////////////////////////////////////////////////
+wxTerm::MemoryUse wxTerm::GetMemoryUse()
+{
+    MemoryUse use;
+
+    use.own = sizeof(*this) + GTerm::GetMemoryUse() + m_pendingInput.capacity() + m_pixelRenderer.GetMemory();
+    if (m_bitmap)
+        use.own += (size_t)m_bitmap->GetWidth() * m_bitmap->GetHeight() * 4;
+    if (m_thumbnail.IsOk())
+        use.own += (size_t)m_thumbnail.GetWidth() * m_thumbnail.GetHeight() * 4 +
+                   m_thumbPixels.capacity() * sizeof(uint32_t) + m_thumbRows.capacity() * sizeof(uint32_t);
+
+    use.sharedWith = m_resources->GetUsers();
+    use.shared = m_resources->GetMemory() / use.sharedWith +
+                 TermResources::GetScratchMemory() / TermResources::GetTotalUsers();
+    return use;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  InkDensity
+///  Guesses how much of a cell a character covers, for thumbnails
+///
+///  @param  c unsigned char  The character
+///
+///  @return int Coverage, 0 to 255
+//////////////////////////////////////////////////////////////////////////////
+static int InkDensity(unsigned char c)
+{
+    static unsigned char density[256];
+    static bool made = false;
+    int i;
+
+    if (!made)
+    {
+        for (i = 1; i < 256; i++)
+            density[i] = isalnum(i) ? 104 : ispunct(i) ? 56 : 96;
+        density[' '] = 0;
+        // the PC shades and blocks
+        density[176] = 64;
+        density[177] = 128;
+        density[178] = 192;
+        density[219] = 255;
+        for (i = 220; i <= 223; i++)
+            density[i] = 128;
+        made = true;
+    }
+    return density[c];
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  public GetThumbnail
+///  Draws a small picture of the screen straight from the text and colours,
+///  one pixel across and scale down to a cell, each its background blended
+///  towards its foreground by how much ink its character has.  Only rows
+///  whose RowVersion changed since the last call are drawn and copied to
+///  the bitmap, so one that hasn't changed costs a compare a row.  The
+///  screen is shown as it is, not scrolled back
+///
+///  @param  scale int  Pixels down to a cell, 1 or 2; with 2 underlining
+///                     shows in the lower one
+///
+///  @return const wxBitmap & The thumbnail, Width() by Height() * scale pixels
+//////////////////////////////////////////////////////////////////////////////
+const wxBitmap &wxTerm::GetThumbnail(int scale)
+{
+    const unsigned char *text;
+    const unsigned short *color;
+    uint32_t palette[16], *row, fgp, bgp;
+    int w = Width(), h = Height(), x, y, y1 = h, y2 = -1, fg, bg, a, shift;
+
+    m_stats.thumbnails++;
+    scale = scale > 1 ? 2 : 1;
+    if (scale != m_thumbScale || !m_thumbnail.IsOk() || m_thumbnail.GetWidth() != w ||
+        m_thumbnail.GetHeight() != h * scale)
+    {
+        m_thumbScale = scale;
+        m_thumbnail.Create(w, h * scale, 24);
+        m_thumbPixels.assign((size_t)w * h * scale, 0);
+        m_thumbRows.clear();
+    }
+    // a row never written has version 0, so every row is drawn the first time
+    bool all = (int)m_thumbRows.size() != h;
+    if (all)
+        m_thumbRows.assign(h, 0);
+
+    for (x = 0; x < 16; x++)
+        palette[x] = ((uint32_t)m_colors[x].Red() << 16) | ((uint32_t)m_colors[x].Green() << 8) |
+                     m_colors[x].Blue();
+
+    for (y = 0; y < h; y++)
+    {
+        if (!all && m_thumbRows[y] == RowVersion(y))
+            continue;
+        m_thumbRows[y] = RowVersion(y);
+        y1 = std::min(y1, y);
+        y2 = y;
+        m_stats.thumbRows++;
+
+        GetScreenRow(y, &text, &color);
+        row = m_thumbPixels.data() + (size_t)y * scale * w;
+        for (x = 0; x < w; x++)
+        {
+            run_colors(color[x], fg, bg);
+            TextColours(fg, bg, color[x]);
+            fgp = palette[fg];
+            bgp = palette[bg];
+            a = InkDensity(text[x]);
+            row[x] = 0;
+            for (shift = 0; shift < 24; shift += 8)
+                row[x] |= ((((fgp >> shift) & 255) * a + ((bgp >> shift) & 255) * (255 - a)) / 255) << shift;
+            if (scale > 1)
+                row[w + x] = color[x] & UNDERLINE ? fgp : row[x];
+        }
+    }
+    if (y2 < 0)
+        return m_thumbnail;
+
+    wxNativePixelData data(m_thumbnail, wxPoint(0, y1 * scale), wxSize(w, (y2 - y1 + 1) * scale));
+    if (!data)
+        return m_thumbnail;
+    wxNativePixelData::Iterator p(data);
+    for (y = y1 * scale; y < (y2 + 1) * scale; y++)
+    {
+        wxNativePixelData::Iterator line = p;
+        row = m_thumbPixels.data() + (size_t)y * w;
+        for (x = 0; x < w; x++, ++p)
+        {
+            p.Red() = row[x] >> 16;
+            p.Green() = row[x] >> 8;
+            p.Blue() = row[x];
+        }
+        p = line;
+        p.OffsetY(data, 1);
+    }
+    return m_thumbnail;
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1614,7 +2721,7 @@ void wxTerm::PrintChars(int len, unsigned char *data)
 
 //////////////////////////////////////////////////////////////////////////////
 ///  private OnGainFocus
-///  Enables the cursor
+///  Lets the cursor blink
 ///
 ///  @param  event wxFocusEvent & The generated focus event
 ///
@@ -1624,13 +2731,16 @@ void wxTerm::PrintChars(int len, unsigned char *data)
 //////////////////////////////////////////////////////////////////////////////
 void wxTerm::OnGainFocus(wxFocusEvent &event)
 {
-    this->set_mode_flag(BLINK);
-    Dirty();
+    m_hasFocus = true;
+    m_curState = 1;
+    m_blinkTimer = wxGetUTCTimeMillis();
+    RefreshCursor();
+    UpdateTimers();
 }
 
 //////////////////////////////////////////////////////////////////////////////
 ///  private OnLoseFocus
-///  Disables the cursor
+///  Stops the cursor blinking, leaving it shown
 ///
 ///  @param  event wxFocusEvent & The generated focus event
 ///
@@ -1640,13 +2750,20 @@ void wxTerm::OnGainFocus(wxFocusEvent &event)
 //////////////////////////////////////////////////////////////////////////////
 void wxTerm::OnLoseFocus(wxFocusEvent &event)
 {
-    this->clear_mode_flag(BLINK);
-    Dirty();
+    m_hasFocus = false;
+    UpdateTimers();
+    if (!m_curState)
+    {
+        m_curState = 1;
+        RefreshCursor();
+    }
 }
 
 //////////////////////////////////////////////////////////////////////////////
 ///  private OnSize
-///  Lets the terminal resize the text whenever the window is resized
+///  Lets the terminal resize the text whenever the window is resized.  A
+///  drag sends a stream of these, so the size is applied from
+///  OnResizeTimer, at most every RESIZE_DELAY_MSECS
 ///
 ///  @param  event wxSizeEvent & The generated size event
 ///
@@ -1654,7 +2771,22 @@ void wxTerm::OnLoseFocus(wxFocusEvent &event)
 ///
 ///  @author Mark Erikson @date 04-22-2004
 //////////////////////////////////////////////////////////////////////////////
-void wxTerm::OnSize(wxSizeEvent &event) { UpdateSize(); }
+void wxTerm::OnSize(wxSizeEvent &event)
+{
+    m_stats.sizeEvents++;
+    if (!m_resizeTimer.IsRunning())
+        m_resizeTimer.Start(RESIZE_DELAY_MSECS, wxTIMER_ONE_SHOT);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///  private OnResizeTimer
+///  Resizes the terminal to the window size reached since OnSize
+///
+///  @param  event wxTimerEvent & The generated timer event
+///
+///  @return void
+//////////////////////////////////////////////////////////////////////////////
+void wxTerm::OnResizeTimer(wxTimerEvent &WXUNUSED(event)) { UpdateSize(); }
 
 void wxTerm::UpdateRemoteSize(int width, int height) {}
 
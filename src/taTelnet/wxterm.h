@@ -22,10 +22,17 @@ License: wxWindows License Version 3.1 (See the file license3.txt)
 #include <wx/font.h>
 #include <wx/gdicmn.h>
 #include <wx/scrolwin.h>
+#include <wx/stopwatch.h>
 #include <wx/string.h>
 #include <wx/timer.h>
 #include <wx/window.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
 #include "../GTerm/gterm.hpp"
+#include "pixelrenderer.h"
+#include "termresources.h"
 
 #define wxEVT_COMMAND_TERM_RESIZE wxEVT_USER_FIRST + 1000
 #define wxEVT_COMMAND_TERM_NEXT wxEVT_USER_FIRST + 1001
@@ -34,39 +41,176 @@ License: wxWindows License Version 3.1 (See the file license3.txt)
     {wxEVT_COMMAND_TERM_RESIZE, id, -1,                                                            \
      (wxObjectEventFunction)(wxEventFunction)(wxCommandEventFunction) & fn, (wxObject *)NULL},
 
+class wxTermBlinkClock;
+
 class wxTerm : public wxScrolledWindow, public GTerm //wxScrolled<wxWindow>
 {
-    int m_charWidth, m_charHeight, m_init, m_width, m_height, m_selx1, m_sely1, m_selx2, m_sely2,
-        m_curX, m_curY, m_curFG, m_curBG, m_curFlags, m_curState, m_curBlinkRate;
+    friend class wxTermBlinkClock;
+
+    int m_charWidth, m_charHeight, m_init, m_width, m_height, m_curX, m_curY, m_curFG, m_curBG,
+        m_curFlags, m_curState, m_curBlinkRate;
 
     int m_charsInLine;
     int m_linesDisplayed;
 
     unsigned char m_curChar;
 
-    bool m_selecting, m_marking, m_autoscroll;
+    bool m_selecting, m_autoscroll;
+
+    bool m_hasFocus; // the cursor only blinks while the window has the focus
 
     bool m_inUpdateSize;
 
-    wxColour m_vt_colors[16], m_pc_colors[16], *m_colors;
+    TermResources *m_resources; // fonts, colours and glyphs, shared with terminals like this one
 
-    wxPen m_vt_colorPens[16], m_pc_colorPens[16], *m_colorPens;
+    const wxColour *m_colors; // the VT100 or PC palette of m_resources, with its pens and brushes
 
-    wxFont m_normalFont, m_underlinedFont, m_boldFont, m_boldUnderlinedFont;
+    const wxPen *m_colorPens;
+
+    const wxBrush *m_colorBrushes;
 
     wxDC *m_curDC;
 
-    wxMemoryDC m_memDC;
+    // what m_curDC was last given, so drawing only changes what differs
+    struct DCState
+    {
+        const wxFont *font;
+        int textFG, textBG; // colour indices, -1 when not known
+        int backgroundMode;
+        int fill;           // pen and brush colour index
+    };
+
+    DCState m_dcState;
+
+    bool m_metricsValid; // m_charWidth and m_charHeight are for the current font
+
+    // a ClearChars rectangle, in cells, held back in case the next one
+    // continues it
+    struct PendingClear
+    {
+        int color; // -1 when there is none
+        int x, y, w, h;
+    };
+
+    PendingClear m_pendingClear;
+
+    // the rows drawn into the bitmap since it was last brought up to date,
+    // which the window has to repaint; none when m_damageTop > m_damageBottom
+    int m_damageTop, m_damageBottom;
+
+    wxString m_drawString; // the text of one run, reused so drawing doesn't allocate
+
+    wchar_t m_drawChars[MAXWIDTH]; // its glyphs, before they are copied in
+
+    PixelRenderer m_pixelRenderer; // draws instead of m_curDC when m_usePixels is set
+
+    bool m_usePixels;
+
+    wxMemoryDC m_memDC; // the terminal is drawn here and copied to the window in OnPaint
 
     wxBitmap *m_bitmap;
 
+    // the thumbnail, a cell to a pixel across and m_thumbScale down, and the
+    // RowVersion of each row as it was drawn; empty to draw every row
+    wxBitmap m_thumbnail;
+
+    std::vector<uint32_t> m_thumbPixels;
+
+    std::vector<uint32_t> m_thumbRows;
+
+    int m_thumbScale;
+
     FILE *m_printerFN;
 
     char *m_printerName;
 
-    wxTimer m_timer;
+    wxTimer m_timer; // runs only while a synchronized update holds back drawing
+
+    wxTimer m_resizeTimer; // runs while window size changes are being collected
 
-    wxLongLong m_blinkTimer;
+    wxLongLong m_blinkTimer; // when the cursor last moved; it shows steadily for a blink after
+
+    std::string m_pendingInput; // received but not yet parsed, starting at m_pendingPos
+
+    size_t m_pendingPos;
+
+    int m_parseBudgetUsecs, m_parseBudgetBytes;
+
+    bool m_discardOnInterrupt;
+
+    // extracts a large selection for the clipboard; joined before the next
+    // one starts and in the destructor, m_copyCancel telling it to give up
+    std::thread m_copyThread;
+
+    std::atomic<bool> m_copyCancel;
+
+    // the timestamp of the key event being handled, in milliseconds from an
+    // epoch of the platform's own; the clock less the timestamp, the first
+    // time it is smallest, stands for a key handled as soon as it was made
+    long m_keyTimestamp;
+
+    uint32_t m_keyClockBase;
+
+    bool m_keyClockKnown;
+
+public:
+    struct Stats
+    {
+        unsigned long slices;          // ProcessInputSlice calls
+        unsigned long long bytesParsed;
+        long long lastSliceUsecs;
+        long long maxSliceUsecs;
+        long long totalSliceUsecs;
+        unsigned long pendingBytes;    // input waiting for the next idle event
+        unsigned long discardedBytes;  // dropped by an interrupt key
+        unsigned long keys;            // key presses sent to the host
+        long long lastKeyUsecs;        // from the key event's timestamp to SendBack, in whole ms
+        long long maxKeyUsecs;
+        unsigned long sizeEvents;      // EVT_SIZE received
+        unsigned long resizes;         // times the terminal was actually resized
+        unsigned long bitmapAllocs;    // backing bitmaps created
+        long long lastResizeUsecs;     // in ResizeTerminal, reflow and bitmaps included
+        long long maxResizeUsecs;
+        unsigned long frames;             // updates of the bitmap
+        unsigned long dcStateChanges;     // font, colour and mode changes made on the DC
+        unsigned long dcStateSkipped;     // ones left out because already in effect
+        unsigned long lastFrameDCChanges;
+        unsigned long maxFrameDCChanges;
+        unsigned long clears;             // ClearChars calls
+        unsigned long clearRects;         // rectangles they were drawn as
+        unsigned long drawAllocs;         // times the run string had to grow
+        unsigned long lastFrameAllocs;
+        unsigned long cursorRefreshes;    // cursor cells refreshed for a move or a blink
+        unsigned long timerWakeups;       // OnTimer calls
+        unsigned long blinkWakeups;       // shared blink clock ticks that reached this terminal
+        unsigned long hiddenSlices;       // input parsed while not shown, with nothing drawn
+        unsigned long reshows;            // times it was shown again and redrawn
+        unsigned long thumbnails;         // GetThumbnail calls
+        unsigned long thumbRows;          // rows they drew
+    };
+
+    // totals for BenchmarkRedraw's frames in each draw order
+    struct RedrawTimes
+    {
+        long long singlePassUsecs;
+        long long twoPassUsecs;
+        unsigned long singlePassDCChanges;
+        unsigned long twoPassDCChanges;
+        unsigned long singlePassAllocs;
+        unsigned long twoPassAllocs;
+        long long pixelUsecs; // single pass through the PixelRenderer
+    };
+
+    // memory of one terminal, in bytes
+    struct MemoryUse
+    {
+        size_t own;      // its text, history, bitmap and pixel buffer
+        size_t shared;   // its part of the resources and scratch bitmap it shares
+        int sharedWith;  // terminals sharing its resources, itself included
+    };
+
+private:
+    Stats m_stats;
 
 public:
     enum BOLDSTYLE
@@ -108,14 +252,36 @@ public:
     int GetCursorBlinkRate() { return m_curBlinkRate; }
     void SetCursorBlinkRate(int rate);
 
+    void SetParseBudget(int usecs, int bytes = 0);
+    int GetParseBudgetUsecs() { return m_parseBudgetUsecs; }
+    int GetParseBudgetBytes() { return m_parseBudgetBytes; }
+    bool HasPendingInput() { return m_pendingPos < m_pendingInput.size(); }
+    void QueueInput(int len, const char *data);
+    void DiscardPendingInput();
+    void SetDiscardOnInterrupt(bool discard) { m_discardOnInterrupt = discard; }
+    bool GetDiscardOnInterrupt() { return m_discardOnInterrupt; }
+
+    Stats GetStats();
+    void ResetStats();
+    RedrawTimes BenchmarkRedraw(int frames);
+    void SetPixelRendering(bool on);
+    bool GetPixelRendering() { return m_usePixels; }
+    PixelRenderer::Stats GetPixelStats() { return m_pixelRenderer.GetStats(); }
+    static double GetWakeupsPerSecond();
+    void SetPixelThreads(int threads) { m_pixelRenderer.SetThreads(threads); }
+    int GetPixelThreads() { return m_pixelRenderer.GetThreads(); }
+    std::vector<long long> BenchmarkPixelThreads(int frames, int maxThreads);
+    MemoryUse GetMemoryUse();
+    const wxBitmap &GetThumbnail(int scale = 1);
+
     void SetBoldStyle(wxTerm::BOLDSTYLE boldStyle);
     wxTerm::BOLDSTYLE GetBoldStyle(void) { return m_boldStyle; }
 
     void ScrollTerminal(int numLines, bool scrollUp = true);
 
     void ClearSelection();
-    bool HasSelection();
     wxString GetSelection();
+    bool GetSelectionText(std::string &text);
     void SelectAll();
 
     void UpdateSize();
@@ -129,9 +295,11 @@ public:
     virtual void DrawText(int fg_color, int bg_color, int flags, int x, int y, int len,
                           unsigned char *string);
     virtual void DrawCursor(int fg_color, int bg_color, int flags, int x, int y, unsigned char c);
+    virtual void HideCursor();
 
     virtual void MoveChars(int sx, int sy, int dx, int dy, int w, int h);
     virtual void ClearChars(int clear_bg_color, int x, int y, int w, int h);
+    virtual int TextBackground(int fg_color, int bg_color, int flags);
     //  virtual void SendBack(int len, char *data);
     virtual void ModeChange(int state);
     virtual void Bell();
@@ -153,8 +321,11 @@ public:
     bool CharPositionFromPoint(int x, int y, int &column, int &lineNumber);
 
     int MapKeyCode(int keyCode);
-    void MarkSelection();
-    void DoDrawCursor(int fg_color, int bg_color, int flags, int x, int y, unsigned char c);
+    void DoDrawCursor(wxDC &dc);
+    void RefreshCursor();
+    void Blink(wxLongLong now);
+    void UpdateTimers();
+    bool UpdateParseOnly();
 
     virtual void OnChar(wxKeyEvent &event);
     virtual void OnKeyDown(wxKeyEvent &event);
@@ -165,8 +336,11 @@ public:
     virtual void OnLeftUp(wxMouseEvent &event);
     virtual void OnRightDown(wxMouseEvent &event);
     virtual void OnMouseMove(wxMouseEvent &event);
+    virtual void OnMouseWheel(wxMouseEvent &event);
     virtual void OnSize(wxSizeEvent &event);
     virtual void OnTimer(wxTimerEvent &event);
+    virtual void OnResizeTimer(wxTimerEvent &event);
+    virtual void OnIdle(wxIdleEvent &event);
 
     virtual void OnGainFocus(wxFocusEvent &event);
     virtual void OnLoseFocus(wxFocusEvent &event);
@@ -175,6 +349,25 @@ public:
     virtual void OnMenuPaste(wxCommandEvent &event);
 
 private:
+    int ParseSlice(int len, const char *data);
+    void SendKey(int len, const char *data);
+    void StopCopy();
+    void AcquireResources(const wxFont &font, const wxColour vtColors[16], const wxColour pcColors[16]);
+    void UsePalette();
+    void MeasureChars();
+    void InvalidateDCState();
+    const wxFont &FontFor(int flags);
+    void UseFont(const wxFont &font);
+    void UseTextColours(int fg_color, int bg_color);
+    void UseBackgroundMode(int mode);
+    void UseFill(int color);
+    void FlushClear();
+    void DamageRows(int y, int h);
+    void UpdateBitmap();
+    void TextColours(int &fg_color, int &bg_color, int flags);
+    const wxString &GlyphString(const unsigned char *string, int len);
+    int PixelStyle(int flags);
+    void FlushPixels();
 
     DECLARE_EVENT_TABLE()
 };
@@ -66,7 +66,14 @@ void TerminalWx::DisplayCharsUnsafe(const wxString &str)
     ProcessInput(str.length(), str.mb_str());
 }
 
-void TerminalWx::OnTerminalInput(TerminalInputEvent &evt) { DisplayCharsUnsafe(evt.GetString()); }
+/**
+ *  Output posted as events is parsed in idle time, so that a flood of it
+ *  does not hold up key presses
+ */
+void TerminalWx::OnTerminalInput(TerminalInputEvent &evt)
+{
+    QueueInput(evt.GetString().length(), evt.GetString().mb_str());
+}
 
 TerminalWx::~TerminalWx()
 {